@@ -33,35 +33,56 @@ namespace bdfs
 
   void IAsyncResult::Complete()
   {
-    this->completed = true;
+    std::vector<std::function<void()>> pending;
 
-    std::unique_lock<std::mutex> lock(this->mutex);
+    // Set under the lock, which waiters take before they return, so that a
+    // result is not destroyed by its waiter while this is still using it.
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      this->completed = true;
+
+      this->cond.notify_all();
+
+      pending.swap(this->callbacks);
+    }
 
-    this->cond.notify_all();
+    for (auto & callback : pending)
+    {
+      callback();
+    }
   }
 
 
-  bool IAsyncResult::Wait(int msTimeout)
+  void IAsyncResult::OnComplete(std::function<void()> callback)
   {
-    if (this->completed)
     {
-      return true;
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (!this->completed)
+      {
+        this->callbacks.emplace_back(std::move(callback));
+        return;
+      }
     }
 
+    callback();
+  }
+
+
+  bool IAsyncResult::Wait(int msTimeout)
+  {
     std::unique_lock<std::mutex> lock(this->mutex);
 
-    if (this->completed)
-    {
-      return true;
-    }
+    auto done = [this]() { return this->completed.load(); };
 
     if (msTimeout > 0)
     {
-      return this->cond.wait_for(lock, std::chrono::milliseconds(msTimeout)) == std::cv_status::no_timeout;
+      return this->cond.wait_for(lock, std::chrono::milliseconds(msTimeout), done);
     }
     else
     {
-      this->cond.wait(lock);
+      this->cond.wait(lock, done);
       return true;
     }
   }
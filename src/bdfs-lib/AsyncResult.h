@@ -28,6 +28,7 @@
 #include <memory>
 #include <utility>
 #include <functional>
+#include <vector>
 
 namespace bdfs
 {
@@ -43,6 +44,10 @@ namespace bdfs
 
     bool IsCompleted() const    { return this->completed; }
 
+    // Runs 'callback' once the result is completed, or right away if it
+    // already is. The callback runs on the completing thread.
+    void OnComplete(std::function<void()> callback);
+
   private:
 
     std::atomic<bool> completed{false};
@@ -50,6 +55,8 @@ namespace bdfs
     std::mutex mutex;
 
     std::condition_variable cond;
+
+    std::vector<std::function<void()>> callbacks;
   };
 
 
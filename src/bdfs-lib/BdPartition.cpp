@@ -89,6 +89,33 @@ namespace bdfs
   }
 
 
+  AsyncResultPtr<bool> BdPartition::Trim(uint64_t blockId, uint32_t offset, uint32_t size)
+  {
+    BdObject::CArgs args;
+    args["block"] = Json::Value::UInt(blockId);
+    args["offset"] = Json::Value::UInt(offset);
+    args["size"] = Json::Value::UInt(size);
+
+    auto result = std::make_shared<AsyncResult<bool>>();
+
+    bool rtn = this->Call("TrimBlock", args,
+      [result](Json::Value & response, bool error)
+      {
+        if (error || !response.isBool())
+        {
+          result->Complete(false);
+        }
+        else
+        {
+          result->Complete(response.asBool());
+        }
+      }
+    );
+
+    return rtn ? result : nullptr;
+  }
+
+
   AsyncResultPtr<bool> BdPartition::Delete()
   {
     BdObject::CArgs args;
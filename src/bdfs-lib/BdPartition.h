@@ -41,6 +41,11 @@ namespace bdfs
 
     AsyncResultPtr<std::string> Read(uint64_t blockId, uint32_t offset, uint32_t size);
 
+    AsyncResultPtr<bool> Trim(uint64_t blockId, uint32_t offset, uint32_t size);
+
     AsyncResultPtr<bool> Delete();
+
+    // Base address of the session the partition was created in.
+    const std::string & Host() const { return Base(); }
   };
 }
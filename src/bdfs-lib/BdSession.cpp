@@ -25,8 +25,11 @@
 #include "BdObject.h"
 #include "BdTypes.h"
 #include "AsyncQueue.h"
+#include "Lock.h"
 
 #include <sstream>
+#include <map>
+#include <memory>
 
 namespace bdfs
 {
@@ -43,8 +46,23 @@ namespace bdfs
       delete (request);
     }
 
-    AsyncQueue<HttpRequest*> queue(OnDequeue, OnDelete, NULL);
-    static bool queueStarted = false;
+    // Requests are dispatched on one queue per endpoint so that calls to
+    // different hosts run concurrently while calls to the same host keep
+    // their order.
+    Mutex queuesMutex;
+    std::map<std::string, std::unique_ptr<AsyncQueue<HttpRequest*>>> queues;
+
+    AsyncQueue<HttpRequest*> * GetQueue(const std::string & base)
+    {
+      Lock _(queuesMutex);
+      auto & queue = queues[base];
+      if (!queue)
+      {
+        queue.reset(new AsyncQueue<HttpRequest*>(OnDequeue, OnDelete, NULL));
+        queue->Start();
+      }
+      return queue.get();
+    }
   }
 
   SharedMutex BdSession::mutex;
@@ -66,11 +84,6 @@ namespace bdfs
   std::shared_ptr<BdSession> BdSession::CreateSession(const char * base, HttpConfig * config, bool ownConfig)
   {
     WriteLock _(mutex);
-    if (!queueStarted)
-    {
-      queue.Start();
-      queueStarted = true;
-    }
     if (config == NULL)
     {
       ownConfig = false;
@@ -87,6 +100,7 @@ namespace bdfs
     base(base),
     ownConfig(ownConfig)
   {
+    this->queue = GetQueue(this->base);
   }
 
   BdSession::~BdSession()
@@ -145,7 +159,7 @@ namespace bdfs
     }
     
     req->Post(data, callback);
-    queue.Enqueue(req);
+    this->queue->Enqueue(req);
     return true;
   }
 
@@ -160,7 +174,7 @@ namespace bdfs
     }
     
     req->Post(data, callback);
-    queue.Enqueue(req);
+    this->queue->Enqueue(req);
     return true;
   }
 
@@ -183,7 +197,7 @@ namespace bdfs
     if (req != NULL)
     {
       req->Post("application/octet-stream", body, bodyLen, callback);
-      queue.Enqueue(req);
+      this->queue->Enqueue(req);
     }
     return true;
   }
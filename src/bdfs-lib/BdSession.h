@@ -31,6 +31,9 @@ namespace bdfs
 {
   class HttpRequest;
 
+  template <class T>
+  class AsyncQueue;
+
   class BdSession
   {
   private:
@@ -38,6 +41,7 @@ namespace bdfs
     std::string base;
     std::string st;
     bool ownConfig;
+    AsyncQueue<HttpRequest *> * queue;
 
     std::string __EncodeArgs(BdObject::CArgs & args);
 
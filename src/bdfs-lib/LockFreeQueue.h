@@ -23,6 +23,7 @@
 #pragma once
 
 #include <atomic>
+#include <mutex>
 #include <assert.h>
 
 namespace bdfs
@@ -77,6 +78,11 @@ namespace bdfs
     {
       Node * n = new Node(std::move(t));
 
+      // Producers are serialized: a producer holding a stale last node, or
+      // trimming consumed nodes, would otherwise race with another producer
+      // freeing them. The consumer side stays lock-free.
+      std::unique_lock<std::mutex> lock(this->produceMutex);
+
       while (true)
       {
         assert(this->first && this->last && this->divider);
@@ -152,5 +158,7 @@ namespace bdfs
     std::atomic<Node *> last;
 
     std::atomic<size_t> size;
+
+    std::mutex produceMutex;
   };
 }
@@ -273,7 +273,7 @@ void HandleOptions()
       else 
       {
         printf("Creating volume '%s'...\n",Options::Name.c_str());
-        VolumeManager::CreateVolume(Options::Name, Options::Size, Options::DataBlocks, Options::CodeBlocks);
+        VolumeManager::CreateVolume(Options::Name, Options::Size, Options::DataBlocks, Options::CodeBlocks, Options::LocalGroups);
       }
       break;
     }
@@ -299,6 +299,32 @@ void HandleOptions()
       break;
     }
 
+    case Action::Show:
+    {
+      if(Options::Name.empty())
+      {
+        printf("Missing <volumename>\n");
+      }
+      else
+      {
+        args.emplace_back(Options::Name);
+        auto resp = SendReceive(args,bdcp::QUERY_VOLUMESTATUS);
+        auto respParams = bdcp::Parse(resp);
+
+        if(!((bdcp::BdResponse*)resp.get())->status)
+        {
+          printf("Volume '%s' is not binded.\n",Options::Name.c_str());
+          exit(0);
+        }
+
+        for(size_t i = 0; i + 1 < respParams.size(); i += 2)
+        {
+          printf("%-25s%s\n", respParams[i].c_str(), respParams[i+1].c_str());
+        }
+      }
+      break;
+    }
+
     default:
       printf("Unhandled option : %s\n",Action::ToString(Options::Action));
   }
@@ -34,6 +34,7 @@ namespace dfs
   std::string Options::Name;
   uint16_t Options::DataBlocks = 4;
   uint16_t Options::CodeBlocks = 4;
+  uint16_t Options::LocalGroups = 0;
   uint64_t Options::Size =  1*1024*1024*1024; // 1GB
   std::vector<std::string> Options::KademliaUrl;
   std::vector<std::string> Options::Paths;
@@ -54,7 +55,7 @@ namespace dfs
 
     printf("Usage: drive {action} [options] [files]\n");
     printf("\n");
-    printf("Actions: create,delete,mount,unmount,format,list\n");
+    printf("Actions: create,delete,mount,unmount,format,list,show\n");
     printf("\n");
     printf("Options: create\n");
     printf("\n");
@@ -63,6 +64,7 @@ namespace dfs
     printf("  -k {url}       Kademlia server\n");
     printf("  -d {blocks}    Data blocks (1 .. 255)\n");
     printf("  -c {blocks}    Code blocks (1 .. 255)\n");
+    printf("  -l {groups}    Local parity groups (0 .. data blocks)\n");
     printf("  -?|h           Show this help screen\n");
     printf("\n");
     printf("Options: delete\n");
@@ -96,6 +98,11 @@ namespace dfs
     printf("\n");
     printf("  -?|h           Show this help screen\n");
     printf("\n");
+    printf("Options: show\n");
+    printf("\n");
+    printf("  -n {name}      Volume name\n");
+    printf("  -?|h           Show this help screen\n");
+    printf("\n");
     exit(format == NULL ? 0 : 1);
   }
 
@@ -157,6 +164,11 @@ namespace dfs
       Options::DataBlocks = json["dataBlocks"].asUInt();
     }
 
+    if(json["localGroups"].isIntegral())
+    {
+      Options::LocalGroups = json["localGroups"].asUInt();
+    }
+
     if(json["size"].isIntegral())
     {
       Options::Size = json["size"].asUInt();
@@ -209,6 +221,15 @@ namespace dfs
         }
         Options::CodeBlocks = (uint16_t)val;
       }
+      else if (strcmp(arg, "-l") == 0)
+      {
+        int val = atoi(argv[++i]);
+        if (val < 0 || val > 255)
+        {
+          Usage("\nError: Invalid local group count: %d (valid: 0 .. data blocks)\n", val);
+        }
+        Options::LocalGroups = (uint16_t)val;
+      }
       else if (strcmp(arg, "-s") == 0)
       {
         errno = 0;
@@ -261,6 +282,11 @@ namespace dfs
       {
         Usage("\nError: Too many blocks specified: %d (valid: datablocks+codeblocks <= 256)\n", totalBlocks);
       }
+
+      if (Options::LocalGroups > Options::DataBlocks)
+      {
+        Usage("\nError: Too many local groups specified: %d (valid: 0 .. %d)\n", Options::LocalGroups, Options::DataBlocks);
+      }
     }
 
     if (Options::Action == Action::Mount && Paths.size() == 0)
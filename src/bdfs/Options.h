@@ -36,6 +36,7 @@ namespace dfs
     static std::string Name;
     static uint16_t DataBlocks;
     static uint16_t CodeBlocks;
+    static uint16_t LocalGroups;
     static uint64_t Size;
     static std::vector<std::string> KademliaUrl;
     static std::vector<std::string> Paths;
@@ -38,7 +38,8 @@ namespace bdfs
       BIND = 0,
       UNBIND,
       RESPONSE,
-      QUERY_VOLUMEINFO
+      QUERY_VOLUMEINFO,
+      QUERY_VOLUMESTATUS
     };
 
     // paramCount = null terminated params after struct
@@ -57,6 +58,10 @@ namespace bdfs
     // BdResponse for BIND
     // status = 0: Fail, 1: Success, 2: Already Binded
     // data = nbdpath or error message
+    //
+    // BdResponse for QUERY_VOLUMESTATUS
+    // status = 0: Not binded, 1: Success
+    // data = name, value, name, value, ...
     typedef struct
     {
       BdHdr hdr;
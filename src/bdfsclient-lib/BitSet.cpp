@@ -88,6 +88,11 @@ BitSet::BitSet(size_t size) :
   memset(buffer, 0, sizeof(uint64_t)*bufferSize);
 }
 
+BitSet::~BitSet()
+{
+  delete[] buffer;
+}
+
 void BitSet::Print()
 {
   for (size_t i = 0; i < size; i++)
@@ -135,6 +140,21 @@ void BitSet::WriteTo(FILE * file)
   }
 }
 
+void BitSet::WriteWordTo(FILE * file, size_t index)
+{
+  if (index >= size) { return; }
+  size_t word = index >> 6;
+  size_t bytes = sizeof(uint64_t);
+  uint64_t remBits = (0x3F & size);
+  if (remBits && word == (size >> 6))
+  {
+    bytes = (0x7&remBits)?(remBits>>3)+1:(remBits>>3);
+  }
+  uint64_t netBytes = htonll(buffer[word]);
+  fseek(file, word * sizeof(uint64_t), SEEK_SET);
+  fwrite(&netBytes, bytes, 1, file);
+}
+
 BitSet::Reference BitSet::operator[](size_t index)
 {
   return BitSet::Reference(*this, index);
@@ -53,9 +53,14 @@ private:
 
 public:
   BitSet(size_t size);
+  ~BitSet();
+  BitSet(const BitSet &) = delete;
+  BitSet & operator = (const BitSet &) = delete;
   void Print();
   void ReadFrom(FILE * file);
   void WriteTo(FILE * file);
+  // Writes only the word holding bit 'index' to its place in a WriteTo file.
+  void WriteWordTo(FILE * file, size_t index);
   Reference operator[](size_t index);
   const bool __Get(size_t index);
   const void __Set(size_t index, bool value);
@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "BlockCipher.h"
+#include "Util.h"
+
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+namespace dfs
+{
+  BlockCipher::BlockCipher(const char * password)
+  {
+    SHA512(reinterpret_cast<const unsigned char *>(password), strlen(password), key);
+  }
+
+
+  BlockCipher::~BlockCipher()
+  {
+    memset(key, 0, sizeof(key));
+  }
+
+
+  bool BlockCipher::Encrypt(uint64_t row, uint64_t column, const void * in, void * out, size_t size, size_t offset) const
+  {
+    return Crypt(row, column, in, out, size, offset, 1);
+  }
+
+
+  bool BlockCipher::Decrypt(uint64_t row, uint64_t column, const void * in, void * out, size_t size, size_t offset) const
+  {
+    return Crypt(row, column, in, out, size, offset, 0);
+  }
+
+
+  bool BlockCipher::Crypt(uint64_t row, uint64_t column, const void * in, void * out, size_t size, size_t offset, int encrypt) const
+  {
+    return_false_if_msg(size % SECTOR_SIZE != 0 || offset % SECTOR_SIZE != 0, "Error: unaligned sector range [%lx,%lx] at %ld.\n", row, column, offset);
+
+    EVP_CIPHER_CTX * ctx = EVP_CIPHER_CTX_new();
+    return_false_if(ctx == NULL);
+
+    bool success = EVP_CipherInit_ex(ctx, EVP_aes_256_xts(), NULL, key, NULL, encrypt) == 1;
+
+    const uint8_t * src = static_cast<const uint8_t *>(in);
+    uint8_t * dst = static_cast<uint8_t *>(out);
+
+    for (size_t pos = 0; success && pos < size; pos += SECTOR_SIZE)
+    {
+      // Tweak: row (64 bits), column (32 bits) and sector (32 bits), little endian.
+      uint8_t tweak[16];
+      uint64_t sector = (offset + pos) / SECTOR_SIZE;
+      for (int i = 0; i < 8; ++i)
+      {
+        tweak[i] = static_cast<uint8_t>(row >> (8 * i));
+      }
+      for (int i = 0; i < 4; ++i)
+      {
+        tweak[8 + i] = static_cast<uint8_t>(column >> (8 * i));
+        tweak[12 + i] = static_cast<uint8_t>(sector >> (8 * i));
+      }
+
+      int len = 0;
+      success = EVP_CipherInit_ex(ctx, NULL, NULL, NULL, tweak, -1) == 1 &&
+                EVP_CipherUpdate(ctx, dst + pos, &len, src + pos, static_cast<int>(SECTOR_SIZE)) == 1 &&
+                len == static_cast<int>(SECTOR_SIZE);
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return_false_if_msg(!success, "Error: failed to %s [%lx,%lx].\n", encrypt ? "encrypt" : "decrypt", row, column);
+
+    return true;
+  }
+}
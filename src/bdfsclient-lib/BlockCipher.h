@@ -0,0 +1,57 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace dfs
+{
+  // AES-256-XTS over the cells of a volume. Every 4K sector is encrypted on
+  // its own with a tweak made of its row, column and index in the cell, so a
+  // write only has to touch the sectors it changes and no two sectors of a
+  // volume share a tweak.
+  class BlockCipher
+  {
+  public:
+
+    static const size_t SECTOR_SIZE = 4096;
+
+    // The key is derived from 'password' with SHA-512.
+    explicit BlockCipher(const char * password);
+
+    ~BlockCipher();
+
+    // 'offset' and 'size' are within the cell and multiples of SECTOR_SIZE.
+    bool Encrypt(uint64_t row, uint64_t column, const void * in, void * out, size_t size, size_t offset) const;
+    bool Decrypt(uint64_t row, uint64_t column, const void * in, void * out, size_t size, size_t offset) const;
+
+  private:
+
+    bool Crypt(uint64_t row, uint64_t column, const void * in, void * out, size_t size, size_t offset, int encrypt) const;
+
+  private:
+
+    uint8_t key[64];
+  };
+}
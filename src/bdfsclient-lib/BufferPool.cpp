@@ -0,0 +1,171 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "BufferPool.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+namespace dfs
+{
+  BufferPool::Buffer::Buffer(BufferPool * pool, uint8_t * data, bool pooled)
+    : pool(pool)
+    , data(data)
+    , pooled(pooled)
+  {
+  }
+
+
+  BufferPool::Buffer::Buffer(Buffer && other)
+    : pool(other.pool)
+    , data(other.data)
+    , pooled(other.pooled)
+  {
+    other.data = nullptr;
+  }
+
+
+  BufferPool::Buffer & BufferPool::Buffer::operator=(Buffer && other)
+  {
+    if (this != &other)
+    {
+      reset();
+      this->pool = other.pool;
+      this->data = other.data;
+      this->pooled = other.pooled;
+      other.data = nullptr;
+    }
+
+    return *this;
+  }
+
+
+  BufferPool::Buffer::~Buffer()
+  {
+    reset();
+  }
+
+
+  void BufferPool::Buffer::reset()
+  {
+    if (this->data != nullptr)
+    {
+      this->pool->Release(this->data, this->pooled);
+      this->data = nullptr;
+    }
+  }
+
+
+  BufferPool::BufferPool(size_t bufferSize, size_t capacity, bool hugePages)
+    : bufferSize(bufferSize)
+    , capacity(capacity)
+    , hugePages(hugePages)
+    , slots(new std::atomic<uint8_t *>[capacity])
+    , hits(0)
+    , misses(0)
+  {
+    for (size_t i = 0; i < this->capacity; ++i)
+    {
+      this->slots[i] = nullptr;
+    }
+  }
+
+
+  BufferPool::~BufferPool()
+  {
+    for (size_t i = 0; i < this->capacity; ++i)
+    {
+      free(this->slots[i].exchange(nullptr));
+    }
+  }
+
+
+  BufferPool::Buffer BufferPool::Acquire(size_t size)
+  {
+    if (size == 0)
+    {
+      size = this->bufferSize;
+    }
+
+    if (size > this->bufferSize)
+    {
+      ++this->misses;
+      return Buffer(this, Allocate(size), false);
+    }
+
+    for (size_t i = 0; i < this->capacity; ++i)
+    {
+      if (this->slots[i].load(std::memory_order_relaxed) != nullptr)
+      {
+        uint8_t * data = this->slots[i].exchange(nullptr, std::memory_order_acquire);
+        if (data != nullptr)
+        {
+          ++this->hits;
+          return Buffer(this, data, true);
+        }
+      }
+    }
+
+    ++this->misses;
+    return Buffer(this, Allocate(this->bufferSize), true);
+  }
+
+
+  uint8_t * BufferPool::Allocate(size_t size)
+  {
+    size_t alignment = this->hugePages ? HUGE_PAGE_SIZE : ALIGNMENT;
+    size = (size + alignment - 1) / alignment * alignment;
+
+    void * data = nullptr;
+    if (posix_memalign(&data, alignment, size) != 0)
+    {
+      throw std::bad_alloc();
+    }
+
+    if (this->hugePages)
+    {
+      // Only a hint, the buffer works the same without huge pages
+      madvise(data, size, MADV_HUGEPAGE);
+    }
+
+    return static_cast<uint8_t *>(data);
+  }
+
+
+  void BufferPool::Release(uint8_t * data, bool pooled)
+  {
+    if (pooled)
+    {
+      for (size_t i = 0; i < this->capacity; ++i)
+      {
+        uint8_t * expected = nullptr;
+        if (this->slots[i].load(std::memory_order_relaxed) == nullptr &&
+            this->slots[i].compare_exchange_strong(expected, data, std::memory_order_release))
+        {
+          return;
+        }
+      }
+    }
+
+    free(data);
+  }
+}
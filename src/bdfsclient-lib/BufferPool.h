@@ -0,0 +1,121 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <new>
+
+namespace dfs
+{
+  // Recycles fixed size, 64 byte aligned scratch buffers so that the I/O
+  // paths do not go through the allocator on every call. Up to 'capacity'
+  // released buffers are kept in a lock-free set of slots. Larger requests,
+  // and requests made while every slot is empty, are served by a fresh
+  // allocation and counted as misses.
+  class BufferPool
+  {
+  public:
+
+    static const size_t ALIGNMENT = 64;
+
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // Returns its buffer to the pool when it goes out of scope.
+    class Buffer
+    {
+    public:
+
+      Buffer() = default;
+
+      Buffer(Buffer && other);
+
+      Buffer & operator=(Buffer && other);
+
+      Buffer(const Buffer &) = delete;
+
+      Buffer & operator=(const Buffer &) = delete;
+
+      ~Buffer();
+
+      uint8_t * get() const { return data; }
+
+      explicit operator bool() const { return data != nullptr; }
+
+      void reset();
+
+    private:
+
+      friend class BufferPool;
+
+      Buffer(BufferPool * pool, uint8_t * data, bool pooled);
+
+      BufferPool * pool = nullptr;
+
+      uint8_t * data = nullptr;
+
+      bool pooled = false;
+    };
+
+    // With 'hugePages' buffers are aligned to HUGE_PAGE_SIZE and advised to
+    // be backed by transparent huge pages.
+    BufferPool(size_t bufferSize, size_t capacity, bool hugePages = false);
+
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+
+    BufferPool & operator=(const BufferPool &) = delete;
+
+    // A buffer of at least 'size' bytes, BufferSize() if 0.
+    Buffer Acquire(size_t size = 0);
+
+    size_t BufferSize() const { return bufferSize; }
+
+    uint64_t Hits() const { return hits; }
+
+    uint64_t Misses() const { return misses; }
+
+  private:
+
+    uint8_t * Allocate(size_t size);
+
+    void Release(uint8_t * data, bool pooled);
+
+  private:
+
+    size_t bufferSize;
+
+    size_t capacity;
+
+    bool hugePages;
+
+    std::unique_ptr<std::atomic<uint8_t *>[]> slots;
+
+    std::atomic<uint64_t> hits;
+
+    std::atomic<uint64_t> misses;
+  };
+}
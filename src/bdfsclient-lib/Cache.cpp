@@ -24,45 +24,28 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 #include <assert.h>
 #include <vector>
 #include <chrono>
 #include <string.h>
-#include <inttypes.h>
 #include "Volume.h"
 #include "Buffer.h"
 #include "Cache.h"
+#include "Util.h"
 
 namespace dfs
 {
-  static int mkpath(char* path, mode_t mode)
-  {
-    char * p = path;
+  // Rows whose last eviction is remembered for Fill, by row modulo this.
+  static const size_t EVICTED_SLOTS = 1024;
 
-    do
-    {
-      p = strchr(p + 1, '/');
-      if (p)
-      {
-        *p = '\0';
-      }
+  // Dirty rows handed to the write-back between checks for pending requests.
+  static const size_t FLUSH_BATCH_ROWS = 16;
 
-      int rtn = mkdir(path, mode);
-
-      if (p)
-      {
-        *p = '/';
-      }
-
-      if (rtn == -1 && errno != EEXIST)
-      {
-        return -1;
-      }
-    } while (p);
-
-    return 0;
-  }
+  // Writers are held back at most this many seconds, in case the write-back
+  // can't get anywhere.
+  static const uint32_t THROTTLE_TIMEOUT = 30;
 
 
   static void cleanpath(const char * folder)
@@ -96,15 +79,41 @@ namespace dfs
   }
 
 
-  Cache::Cache(std::string root, Volume * volume, size_t limit, uint32_t flushPolicy)
+  Cache::Cache(std::string root, Volume * volume, size_t limit, uint32_t flushPolicy, size_t memoryLimit, const std::string & policy,
+               size_t workers, size_t hostUploads, size_t dirtyLimit)
     : rootPath(std::move(root))
-    , limit(limit)
     , flushPolicy(flushPolicy)
     , volume(volume)
+    , dirtyLimit(dirtyLimit)
     , active(true)
   {
     assert(volume);
 
+    std::string name = policy;
+    if (!CachePolicy::Create(name, 1))
+    {
+      printf("Error: unknown cache policy '%s', using lru.\n", policy.c_str());
+      name = "lru";
+    }
+
+    workers = std::max<size_t>(workers, 1);
+
+    // Room for every cell of the rows the cache holds, plus the row each
+    // worker adds before it evicts one.
+    size_t rows = 0;
+
+    for (size_t i = 0; i < workers; ++i)
+    {
+      std::unique_ptr<Worker> worker(new Worker());
+      worker->limit = std::max<size_t>((limit + workers - 1) / workers, 1);
+      worker->policy = CachePolicy::Create(name, worker->limit);
+      worker->evicted.resize(EVICTED_SLOTS, 0);
+
+      rows += worker->limit + 1;
+
+      this->workers.push_back(std::move(worker));
+    }
+
     if (rootPath.empty())
     {
       rootPath = "cache";
@@ -118,7 +127,30 @@ namespace dfs
     mkpath(const_cast<char *>(rootPath.c_str()), 0755);
     cleanpath(rootPath.c_str());
 
-    this->thread = std::thread(std::bind(&Cache::ThreadProc, this));
+    std::string slabPath = rootPath + "/slab";
+    this->slabFile = open(slabPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (this->slabFile < 0)
+    {
+      printf("Error: failed to create cache file '%s'.\n", slabPath.c_str());
+    }
+    else
+    {
+      this->GrowSlab(rows * volume->Columns());
+    }
+
+    if (memoryLimit > 0)
+    {
+      this->memory.reset(new MemoryCache(volume->BlockSize(), memoryLimit,
+        std::bind(&Cache::DemoteSlot, this, std::placeholders::_1, std::placeholders::_2)));
+    }
+
+    this->writeBack.reset(new WriteBack(volume, hostUploads,
+      std::bind(&Cache::OnWritten, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)));
+
+    for (auto & worker : this->workers)
+    {
+      worker->thread = std::thread(std::bind(&Cache::ThreadProc, this, std::ref(*worker)));
+    }
   }
 
 
@@ -128,19 +160,51 @@ namespace dfs
     {
       this->active = false;
 
+      for (auto & worker : this->workers)
       {
-        std::unique_lock<std::mutex> lock(this->mutex);
-        this->hasNotification = true;
-        this->cond.notify_all();
+        std::unique_lock<std::mutex> lock(worker->mutex);
+        worker->hasNotification = true;
+        worker->cond.notify_all();
       }
 
-      if (this->thread.joinable())
+      for (auto & worker : this->workers)
+      {
+        if (worker->thread.joinable())
+        {
+          worker->thread.join();
+        }
+      }
+
+      std::unique_lock<std::mutex> lock(this->throttleMutex);
+      this->throttleCond.notify_all();
+    }
+
+    for (auto & worker : this->workers)
+    {
+      this->Flush(*worker, true);
+    }
+
+    // Uploads what was handed over
+    this->writeBack.reset();
+
+    for (auto & worker : this->workers)
+    {
+      this->CollectWritten(*worker);
+
+      for (auto & sync : worker->syncs)
       {
-        this->thread.join();
+        for (auto req : sync.requests)
+        {
+          req->result.Complete(false);
+        }
       }
     }
 
-    this->Flush(true);
+    if (this->slabFile >= 0)
+    {
+      close(this->slabFile);
+    }
+
     cleanpath(this->rootPath.c_str());
   }
 
@@ -149,7 +213,7 @@ namespace dfs
   {
     assert(buffer);
     if (!this->active ||
-        column >= this->volume->DataCount() + this->volume->CodeCount() ||
+        column >= this->volume->Columns() ||
         size + offset > this->volume->BlockSize())
     {
       return false;
@@ -157,103 +221,326 @@ namespace dfs
 
     ReadRequest req{row, column, buffer, size, offset};
 
-    if (!this->requests.Produce(&req))
+    return this->Submit(this->GetWorker(row), &req, req.result);
+  }
+
+
+  bool Cache::Write(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
+  {
+    assert(buffer);
+    if (!this->active ||
+        column >= this->volume->Columns() ||
+        size + offset > this->volume->BlockSize())
     {
       return false;
     }
 
+    this->Throttle();
+
+    WriteRequest req{row, column, buffer, size, offset};
+
+    return this->Submit(this->GetWorker(row), &req, req.result);
+  }
+
+
+  bool Cache::Read(uint64_t row, std::vector<CellIo> & cells)
+  {
+    if (!this->active)
     {
-      std::unique_lock<std::mutex> lock(this->mutex);
-      this->hasNotification = true;
-      this->cond.notify_one();
+      return false;
     }
 
-    if (req.result.Wait())
+    for (const auto & cell : cells)
     {
-      return req.result.GetResult();
+      assert(cell.buffer);
+      if (cell.column >= this->volume->Columns() ||
+          cell.size + cell.offset > this->volume->BlockSize())
+      {
+        return false;
+      }
     }
 
-    return false;
+    CellsRequest req{RequestType::ReadCells, row, cells};
+
+    return this->Submit(this->GetWorker(row), &req, req.result);
   }
 
 
-  bool Cache::Write(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
+  bool Cache::Write(uint64_t row, std::vector<CellIo> & cells)
   {
-    assert(buffer);
-    if (!this->active ||
-        column >= this->volume->DataCount() + this->volume->CodeCount() ||
-        size + offset > this->volume->BlockSize())
+    if (!this->active)
     {
       return false;
     }
 
-    WriteRequest req{row, column, buffer, size, offset};
+    for (const auto & cell : cells)
+    {
+      assert(cell.buffer);
+      if (cell.column >= this->volume->Columns() ||
+          cell.size + cell.offset > this->volume->BlockSize())
+      {
+        return false;
+      }
+    }
 
-    if (!this->requests.Produce(&req))
+    this->Throttle();
+
+    CellsRequest req{RequestType::WriteCells, row, cells};
+
+    return this->Submit(this->GetWorker(row), &req, req.result);
+  }
+
+
+  bool Cache::Fill(uint64_t row, std::vector<CellIo> & cells, uint64_t epoch)
+  {
+    if (!this->active)
     {
       return false;
     }
 
+    for (const auto & cell : cells)
     {
-      std::unique_lock<std::mutex> lock(this->mutex);
-      this->hasNotification = true;
-      this->cond.notify_one();
+      assert(cell.buffer);
+      if (cell.column >= this->volume->Columns() ||
+          cell.size != this->volume->BlockSize() ||
+          cell.offset != 0)
+      {
+        return false;
+      }
     }
 
-    if (req.result.Wait())
+    CellsRequest req{RequestType::FillCells, row, cells};
+    req.epoch = epoch;
+
+    return this->Submit(this->GetWorker(row), &req, req.result);
+  }
+
+
+  bool Cache::Discard(uint64_t row)
+  {
+    if (!this->active)
     {
-      return req.result.GetResult();
+      return false;
+    }
+
+    DiscardRequest req{row};
+
+    return this->Submit(this->GetWorker(row), &req, req.result);
+  }
+
+
+  bool Cache::Sync()
+  {
+    if (!this->active)
+    {
+      return false;
+    }
+
+    // Every worker writes back its own rows, all at the same time
+    std::vector<SyncRequest> reqs(this->workers.size());
+    std::vector<bool> posted(this->workers.size());
+
+    for (size_t i = 0; i < this->workers.size(); ++i)
+    {
+      posted[i] = this->Post(*this->workers[i], &reqs[i]);
+    }
+
+    bool success = true;
+
+    for (size_t i = 0; i < this->workers.size(); ++i)
+    {
+      success = posted[i] && reqs[i].result.Wait() && reqs[i].result.GetResult() && success;
+    }
+
+    return success;
+  }
+
+
+  bool Cache::Post(Worker & worker, Request * req)
+  {
+    if (!worker.requests.Produce(req))
+    {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    worker.hasNotification = true;
+    worker.cond.notify_one();
+
+    return true;
+  }
+
+
+  bool Cache::Submit(Worker & worker, Request * req, bdfs::AsyncResult<bool> & result)
+  {
+    if (!this->Post(worker, req))
+    {
+      return false;
+    }
+
+    if (result.Wait())
+    {
+      return result.GetResult();
     }
 
     return false;
   }
 
 
-  void Cache::ThreadProc()
+  void Cache::Throttle()
+  {
+    if (this->dirtyLimit == 0 || this->dirtyBytes <= this->dirtyLimit)
+    {
+      return;
+    }
+
+    // The workers hand their dirty rows over right away instead of waiting
+    // for the next periodic flush
+    for (auto & worker : this->workers)
+    {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      worker->hasNotification = true;
+      worker->cond.notify_one();
+    }
+
+    std::unique_lock<std::mutex> lock(this->throttleMutex);
+    this->throttleCond.wait_for(lock, std::chrono::seconds(THROTTLE_TIMEOUT), [this]() {
+      return !this->active || this->dirtyBytes <= this->dirtyLimit;
+    });
+  }
+
+
+  void Cache::OnWritten(uint64_t row, uint64_t version, bool success)
+  {
+    Worker & worker = this->GetWorker(row);
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    worker.written.push_back({row, version, success});
+    worker.hasNotification = true;
+    worker.cond.notify_one();
+  }
+
+
+  void Cache::ThreadProc(Worker & worker)
   {
     uint64_t ts = static_cast<uint64_t>(time(nullptr));
 
     while (this->active)
     {
       Request * req = nullptr;
+      std::vector<SyncRequest *> syncs;
+
+      this->CollectWritten(worker);
 
-      while (this->requests.Consume(req))
+      if (worker.items.size() > worker.limit)
+      {
+        // Rows that could not be evicted while they were dirty
+        this->Pop(worker);
+      }
+
+      while (worker.requests.Consume(req))
       {
         switch (req->type)
         {
           case RequestType::Read:
           {
             auto read = static_cast<ReadRequest *>(req);
-            read->result.Complete(ReadImpl(read->row, read->column, read->buffer, read->size, read->offset));
+            worker.policy->Access(read->row);
+            read->result.Complete(ReadImpl(worker, read->row, read->column, read->buffer, read->size, read->offset));
             break;
           }
 
           case RequestType::Write:
           {
             auto write = static_cast<WriteRequest *>(req);
-            write->result.Complete(WriteImpl(write->row, write->column, write->buffer, write->size, write->offset));
+            worker.policy->Access(write->row);
+            write->result.Complete(WriteImpl(worker, write->row, write->column, write->buffer, write->size, write->offset));
+            break;
+          }
+
+          case RequestType::ReadCells:
+          {
+            auto read = static_cast<CellsRequest *>(req);
+            worker.policy->Access(read->row);
+            read->result.Complete(ReadImpl(worker, read->row, read->cells));
+            break;
+          }
+
+          case RequestType::WriteCells:
+          {
+            auto write = static_cast<CellsRequest *>(req);
+            worker.policy->Access(write->row);
+            write->result.Complete(WriteImpl(worker, write->row, write->cells));
             break;
           }
+
+          case RequestType::FillCells:
+          {
+            auto fill = static_cast<CellsRequest *>(req);
+            fill->result.Complete(FillImpl(worker, fill->row, fill->cells, fill->epoch));
+            break;
+          }
+
+          case RequestType::Discard:
+          {
+            auto discard = static_cast<DiscardRequest *>(req);
+            discard->result.Complete(DiscardImpl(worker, discard->row));
+            break;
+          }
+
+          case RequestType::Sync:
+          {
+            syncs.push_back(static_cast<SyncRequest *>(req));
+            break;
+          }
+        }
+      }
+
+      if (syncs.size() > 0)
+      {
+        // Everything queued before the syncs has been applied, so they all
+        // wait for the rows that are dirty now
+        PendingSync pending;
+        pending.requests = std::move(syncs);
+        pending.success = this->Flush(worker, true);
+
+        for (const auto & item : worker.items)
+        {
+          if (item.second.dirty)
+          {
+            pending.rows[item.first] = item.second.version;
+          }
         }
+
+        worker.syncs.push_back(std::move(pending));
+        this->CompleteSyncs(worker);
+        continue;
+      }
+
+      // Past half the limit rows are written back early, so that writers
+      // are rarely held back
+      if (this->dirtyLimit > 0 && this->dirtyBytes > this->dirtyLimit / 2)
+      {
+        this->Flush(worker, false);
       }
 
       uint64_t now = static_cast<uint64_t>(time(nullptr));
 
       if (now - ts < this->flushPolicy)
       {
-        std::unique_lock<std::mutex> lock(this->mutex);
-        if (!this->hasNotification)
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        if (!worker.hasNotification)
         {
-          this->cond.wait_for(lock, std::chrono::seconds(this->flushPolicy - (now - ts)));
+          worker.cond.wait_for(lock, std::chrono::seconds(this->flushPolicy - (now - ts)));
         }
         else
         {
-          this->hasNotification = false;
+          worker.hasNotification = false;
         }
       }
       else
       {
-        if (this->Flush(false))
+        if (this->Flush(worker, false))
         {
           ts = now;
         }
@@ -262,181 +549,339 @@ namespace dfs
   }
 
 
-  bool Cache::ReadImpl(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset)
+  bool Cache::ReadImpl(Worker & worker, uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset)
   {
-    uint8_t * buf = nullptr;
-    if (size == this->volume->BlockSize() && offset == 0)
-    {
-      buf = static_cast<uint8_t *>(buffer);
-    }
-    else
-    {
-      buf = new uint8_t[this->volume->BlockSize()];
-    }
-
-    char filename[PATH_MAX];
-    sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), row);
-
-    bool success = this->ReadFileBlock(filename, column, buf);
+    bool success = this->ReadSlot(worker, row, column, buffer, size, offset);
 
     if (!success)
     {
+      uint8_t * buf = nullptr;
+      BufferPool::Buffer tmp;
+      if (size == this->volume->BlockSize() && offset == 0)
+      {
+        buf = static_cast<uint8_t *>(buffer);
+      }
+      else
+      {
+        tmp = this->volume->BlockPool().Acquire();
+        buf = tmp.get();
+      }
+
       success = this->volume->__ReadDirect(row, column, buf, this->volume->BlockSize(), 0);
       if (success)
       {
         // Do not fail if write cache fails since we are just reading data
-        this->WriteFileBlock(filename, column, buf);
-      }
-    }
+        if (this->Admit(worker, row) && this->WriteSlot(worker, row, column, buf))
+        {
+          this->Touch(worker, row, false);
+        }
 
-    if (buf != buffer)
-    {
-      memcpy(buffer, buf + offset, size);
-      delete[] buf;
+        if (tmp)
+        {
+          memcpy(buffer, buf + offset, size);
+        }
+      }
     }
 
-    this->UpdateTimestamp(row, false);
-
     return success;
   }
 
 
-  bool Cache::WriteImpl(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
+  bool Cache::WriteImpl(Worker & worker, uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
   {
+    auto slot = worker.slots.find(row * this->volume->Columns() + column);
+    if (this->memory && slot != worker.slots.end() && this->memory->Update(slot->second, buffer, size, offset))
+    {
+      this->Touch(worker, row, true);
+      return true;
+    }
+
     uint8_t * buf = nullptr;
+    BufferPool::Buffer tmp;
     if (size == this->volume->BlockSize() && offset == 0)
     {
       buf = const_cast<uint8_t *>(static_cast<const uint8_t *>(buffer));
     }
     else
     {
-      buf = new uint8_t[this->volume->BlockSize()];
-      if (!this->ReadImpl(row, column, buf, this->volume->BlockSize(), 0))
+      tmp = this->volume->BlockPool().Acquire();
+      buf = tmp.get();
+      if (!this->ReadImpl(worker, row, column, buf, this->volume->BlockSize(), 0))
       {
-        delete[] buf;
         return false;
       }
 
       memcpy(buf + offset, buffer, size);
     }
 
-    char filename[PATH_MAX];
-    sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), row);
-
-    bool success = this->WriteFileBlock(filename, column, buf);
-
-    if (buf != buffer)
-    {
-      delete[] buf;
-    }
+    bool success = this->WriteSlot(worker, row, column, buf);
 
     if (success)
     {
-      this->UpdateTimestamp(row, true);
+      this->Touch(worker, row, true);
     }
 
     return success;
   }
 
 
-  void Cache::Pop()
+  bool Cache::ReadImpl(Worker & worker, uint64_t row, std::vector<CellIo> & cells)
   {
-    size_t size = this->items.size();
+    size_t blockSize = this->volume->BlockSize();
 
-    bool flushed = false;
+    // Serve hits from the slab and collect the misses so that they
+    // can be fetched from all partitions in a single round trip.
+    std::vector<CellIo> misses;
+    std::vector<size_t> missIndex;
+    std::vector<BufferPool::Buffer> missBuffers;
 
-    auto ts = this->timestamps.begin();
-
-    while (ts != this->timestamps.end() && size == this->items.size())
+    for (size_t i = 0; i < cells.size(); ++i)
     {
-      auto it = this->items.find(ts->second);
-      if (it != this->items.end())
+      auto & cell = cells[i];
+
+      cell.success = this->ReadSlot(worker, row, cell.column, cell.buffer, cell.size, cell.offset);
+
+      if (!cell.success)
       {
-        if (it->second.dirty && !flushed)
+        uint8_t * buf = nullptr;
+        BufferPool::Buffer tmp;
+        if (cell.size == blockSize && cell.offset == 0)
         {
-          this->Flush(false);
+          buf = static_cast<uint8_t *>(cell.buffer);
         }
-
-        if (!it->second.dirty)
+        else
         {
-          char filename[PATH_MAX];
-          sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), ts->second);
-          unlink(filename);
-
-          this->items.erase(it);
+          tmp = this->volume->BlockPool().Acquire();
+          buf = tmp.get();
         }
-        else
+
+        misses.push_back({cell.column, buf, blockSize, 0, false});
+        missIndex.push_back(i);
+        missBuffers.emplace_back(std::move(tmp));
+      }
+    }
+
+    if (misses.size() > 0)
+    {
+      this->volume->__ReadDirect(row, misses);
+
+      bool admit = this->Admit(worker, row);
+      bool added = false;
+
+      for (size_t i = 0; i < misses.size(); ++i)
+      {
+        auto & cell = cells[missIndex[i]];
+        cell.success = misses[i].success;
+
+        if (cell.success)
         {
-          ++ts;
-          continue;
+          // Do not fail if write cache fails since we are just reading data
+          if (admit && this->WriteSlot(worker, row, cell.column, misses[i].buffer))
+          {
+            added = true;
+          }
+
+          if (missBuffers[i])
+          {
+            memcpy(cell.buffer, missBuffers[i].get() + cell.offset, cell.size);
+          }
         }
       }
 
-      this->timestamps.erase(ts++);
+      if (added)
+      {
+        this->Touch(worker, row, false);
+      }
     }
+
+    bool success = true;
+    for (const auto & cell : cells)
+    {
+      success = success && cell.success;
+    }
+
+    return success;
   }
 
 
-  bool Cache::Flush(bool force)
+  bool Cache::WriteImpl(Worker & worker, uint64_t row, std::vector<CellIo> & cells)
   {
-    bool all = true;
+    bool success = true;
 
-    bdfs::Buffer buf;
+    for (auto & cell : cells)
+    {
+      cell.success = this->WriteImpl(worker, row, cell.column, cell.buffer, cell.size, cell.offset);
+      success = success && cell.success;
+    }
 
-    uint64_t expire = static_cast<uint64_t>(time(nullptr)) + this->flushPolicy;
+    return success;
+  }
 
-    for (auto ts = this->timestamps.begin(); ts != this->timestamps.end(); ++ts)
+
+  bool Cache::FillImpl(Worker & worker, uint64_t row, std::vector<CellIo> & cells, uint64_t epoch)
+  {
+    if (worker.evicted[row % worker.evicted.size()] > epoch)
     {
-      if (!force && ts->first > expire)
+      return false;
+    }
+
+    bool filled = false;
+
+    for (auto & cell : cells)
+    {
+      if (!cell.success || worker.slots.count(row * this->volume->Columns() + cell.column) > 0)
       {
-        // Not expired yet
-        break;
+        continue;
       }
 
-      auto itr = this->items.find(ts->second);
-      if (itr == this->items.end() || !itr->second.dirty)
+      cell.success = this->WriteSlot(worker, row, cell.column, cell.buffer);
+      filled = filled || cell.success;
+    }
+
+    if (filled)
+    {
+      this->Touch(worker, row, false, false);
+    }
+
+    return filled;
+  }
+
+
+  bool Cache::DiscardImpl(Worker & worker, uint64_t row)
+  {
+    auto itr = worker.items.find(row);
+    if (itr == worker.items.end())
+    {
+      return true;
+    }
+
+    // Cells of the row that went out already are waited for, so that none
+    // lands after the row is trimmed
+    this->writeBack->Cancel(row);
+
+    if (itr->second.dirty)
+    {
+      this->MarkClean(itr->second);
+    }
+
+    worker.items.erase(itr);
+    worker.policy->Erase(row);
+
+    this->ReleaseSlots(worker, row);
+
+    worker.evicted[row % worker.evicted.size()] = ++this->evictions;
+
+    return true;
+  }
+
+
+  void Cache::Pop(Worker & worker)
+  {
+    bool flushed = false;
+
+    while (worker.items.size() > worker.limit)
+    {
+      uint64_t victim = UINT64_MAX;
+      bool flush = false;
+
+      worker.policy->Victims([&](uint64_t row) {
+        auto it = worker.items.find(row);
+        if (it != worker.items.end() && it->second.dirty)
+        {
+          // Write back once, then pass over the rows that are still dirty
+          flush = !flushed;
+          return flushed;
+        }
+
+        victim = row;
+        return false;
+      });
+
+      if (flush)
       {
+        this->Flush(worker, false);
+        flushed = true;
         continue;
       }
 
-      char filename[PATH_MAX];
-      sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), itr->first);
+      if (victim == UINT64_MAX)
+      {
+        return;
+      }
+
+      this->ReleaseSlots(worker, victim);
 
-      FILE * file = fopen(filename, "rb");
-      if (file)
+      worker.items.erase(victim);
+      worker.policy->Erase(victim);
+      worker.evicted[victim % worker.evicted.size()] = ++this->evictions;
+    }
+  }
+
+
+  bool Cache::Flush(Worker & worker, bool force)
+  {
+    bool all = true;
+
+    // Rows next in line for eviction go first
+    std::vector<uint64_t> dirty;
+    worker.policy->Victims([&worker, &dirty](uint64_t row) {
+      auto itr = worker.items.find(row);
+      if (itr != worker.items.end() && itr->second.dirty && !itr->second.queued)
       {
-        bool success = true;
+        dirty.push_back(row);
+      }
+      return true;
+    });
 
-        uint64_t column = 0;
-        while (fread(&column, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
-        {
-          buf.Resize(this->volume->BlockSize());
+    size_t blockSize = this->volume->BlockSize();
+    bdfs::Buffer buf;
 
-          if (fread(buf.Buf(), 1, this->volume->BlockSize(), file) != this->volume->BlockSize() ||
-              !this->volume->__WriteDirect(itr->first, column, buf.Buf(), this->volume->BlockSize(), 0))
-          {
-            success = false;
-            break;
-          }
-        }
+    for (size_t i = 0; i < dirty.size(); ++i)
+    {
+      auto itr = worker.items.find(dirty[i]);
 
-        fclose(file);
+      // Every cell of the row is handed over, so that the row is written
+      // back whole. The write-back keeps a copy of them.
+      std::vector<CellIo> cells;
+      bool success = true;
 
-        if (success)
+      for (uint64_t column = 0; column < this->volume->Columns() && success; ++column)
+      {
+        if (worker.slots.count(itr->first * this->volume->Columns() + column) == 0)
         {
-          itr->second.dirty = false;
+          continue;
         }
-        else
+
+        success = buf.Resize((cells.size() + 1) * blockSize) &&
+                  this->ReadSlot(worker, itr->first, column, static_cast<uint8_t *>(buf.Buf()) + cells.size() * blockSize, blockSize, 0, false);
+
+        cells.push_back({column, nullptr, blockSize, 0, false});
+      }
+
+      if (success)
+      {
+        for (size_t i = 0; i < cells.size(); ++i)
         {
-          printf("Error: failed to flush the cache block: row=%llu column=%llu\n", (long long unsigned)itr->first, (long long unsigned)column);
-          all = false;
+          cells[i].buffer = static_cast<uint8_t *>(buf.Buf()) + i * blockSize;
         }
+
+        success = this->writeBack->Enqueue(itr->first, cells, itr->second.version);
+      }
+
+      if (success)
+      {
+        itr->second.queued = true;
+      }
+      else
+      {
+        printf("Error: failed to flush the cache block: row=%llu\n", (long long unsigned)itr->first);
+        all = false;
       }
 
-      if (this->requests.Size() > 0)
+      if (!force && (i + 1) % FLUSH_BATCH_ROWS == 0 && worker.requests.Size() > 0)
       {
         // We should respond to pending requests first
-        all = (++ts  == this->timestamps.end());
+        all = (i + 1 == dirty.size()) && all;
         break;
       }
     }
@@ -445,113 +890,323 @@ namespace dfs
   }
 
 
-  bool Cache::ReadFileBlock(const char * filename, uint64_t column, void * buffer)
+  void Cache::CollectWritten(Worker & worker)
   {
-    size_t bytes = 0;
+    std::vector<Written> written;
 
-    FILE * file = fopen(filename, "rb");
-    if (file)
     {
-      uint64_t idx = 0;
+      std::unique_lock<std::mutex> lock(worker.mutex);
+      written.swap(worker.written);
+    }
+
+    for (const auto & done : written)
+    {
+      auto itr = worker.items.find(done.row);
+      if (itr == worker.items.end() || !itr->second.dirty)
+      {
+        continue;
+      }
+
+      auto & item = itr->second;
+
+      if (done.success)
+      {
+        item.stored = std::max(item.stored, done.version);
+
+        // Rows written again since are written back once more
+        if (done.version == item.version)
+        {
+          this->MarkClean(item);
+        }
+      }
+      else
+      {
+        if (done.version == item.version)
+        {
+          // Tried again by the next flush
+          item.queued = false;
+        }
+
+        for (auto & sync : worker.syncs)
+        {
+          auto row = sync.rows.find(done.row);
+          if (row != sync.rows.end() && row->second <= done.version)
+          {
+            sync.success = false;
+            sync.rows.erase(row);
+          }
+        }
+      }
+    }
+
+    this->CompleteSyncs(worker);
+  }
+
 
-      while (fread(&idx, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
+  void Cache::CompleteSyncs(Worker & worker)
+  {
+    for (auto sync = worker.syncs.begin(); sync != worker.syncs.end(); )
+    {
+      for (auto row = sync->rows.begin(); row != sync->rows.end(); )
       {
-        if (idx == column)
+        // Rows dropped since were trimmed
+        auto itr = worker.items.find(row->first);
+        if (itr == worker.items.end() || !itr->second.dirty || itr->second.stored >= row->second)
         {
-          bytes = fread(buffer, 1, this->volume->BlockSize(), file);
-          break;
+          row = sync->rows.erase(row);
         }
         else
         {
-          fseek(file, static_cast<long>(this->volume->BlockSize()), SEEK_CUR);
+          ++row;
         }
       }
 
-      fclose(file);
+      if (!sync->rows.empty())
+      {
+        ++sync;
+        continue;
+      }
+
+      for (auto req : sync->requests)
+      {
+        req->result.Complete(sync->success);
+      }
+
+      sync = worker.syncs.erase(sync);
     }
+  }
+
+
+  void Cache::MarkClean(Item & item)
+  {
+    item.dirty = false;
+    item.queued = false;
 
-    return bytes == this->volume->BlockSize();
+    this->dirtyBytes -= item.bytes;
+    item.bytes = 0;
+
+    std::unique_lock<std::mutex> lock(this->throttleMutex);
+    this->throttleCond.notify_all();
   }
 
 
-  bool Cache::WriteFileBlock(const char * filename, uint64_t column, const void * buffer)
+  bool Cache::ReadSlot(Worker & worker, uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset, bool promote)
   {
-    size_t bytes = 0;
+    uint64_t key = row * this->volume->Columns() + column;
 
-    FILE * file = fopen(filename, "rb+");
-    if (!file)
+    auto it = worker.slots.find(key);
+    if (it == worker.slots.end())
     {
-      file = fopen(filename, "wb+");
+      return false;
     }
 
-    if (file)
+    if (this->memory && this->memory->Read(it->second, buffer, size, offset))
     {
-      uint64_t idx = 0;
+      return true;
+    }
+
+    size_t blockSize = this->volume->BlockSize();
+    off_t pos = static_cast<off_t>(it->second * blockSize);
+
+    if (!this->memory || !promote)
+    {
+      return pread(this->slabFile, buffer, size, pos + static_cast<off_t>(offset)) == static_cast<ssize_t>(size);
+    }
+
+    // The whole cell is read so that it can be moved up
+    uint8_t * buf = nullptr;
+    BufferPool::Buffer tmp;
+    if (size == blockSize && offset == 0)
+    {
+      buf = static_cast<uint8_t *>(buffer);
+    }
+    else
+    {
+      tmp = this->volume->BlockPool().Acquire();
+      buf = tmp.get();
+    }
+
+    if (pread(this->slabFile, buf, blockSize, pos) != static_cast<ssize_t>(blockSize))
+    {
+      return false;
+    }
+
+    this->memory->Put(it->second, buf, false);
+
+    if (tmp)
+    {
+      memcpy(buffer, buf + offset, size);
+    }
+
+    return true;
+  }
+
+
+  bool Cache::WriteSlot(Worker & worker, uint64_t row, uint64_t column, const void * buffer)
+  {
+    if (this->slabFile < 0)
+    {
+      return false;
+    }
+
+    uint64_t key = row * this->volume->Columns() + column;
+    size_t blockSize = this->volume->BlockSize();
+
+    auto it = worker.slots.find(key);
+    if (it == worker.slots.end())
+    {
+      size_t slot = 0;
 
-      while (fread(&idx, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
       {
-        if (idx == column)
-        {
-          bytes = fwrite(buffer, 1, this->volume->BlockSize(), file);
-          break;
-        }
-        else
+        std::unique_lock<std::mutex> lock(this->slabMutex);
+
+        if (this->freeSlots.empty() && !this->GrowSlab(this->volume->Columns()))
         {
-          fseek(file, static_cast<long>(this->volume->BlockSize()), SEEK_CUR);
+          return false;
         }
+
+        slot = this->freeSlots.back();
+        this->freeSlots.pop_back();
       }
 
-      if (bytes != this->volume->BlockSize())
+      // Taken up front so that a cell kept in memory has a slot to be
+      // demoted to.
+      it = worker.slots.emplace(key, slot).first;
+
+      if (this->memory && this->memory->Put(slot, buffer, true))
       {
-        if (fwrite(&column, 1, sizeof(column), file) == sizeof(column))
-        {
-          bytes = fwrite(buffer, 1, this->volume->BlockSize(), file);
-        }
+        return true;
+      }
+
+      if (pwrite(this->slabFile, buffer, blockSize, static_cast<off_t>(slot * blockSize)) != static_cast<ssize_t>(blockSize))
+      {
+        worker.slots.erase(it);
+
+        std::unique_lock<std::mutex> lock(this->slabMutex);
+        this->freeSlots.push_back(slot);
+        return false;
       }
 
-      fclose(file);
+      return true;
     }
 
-    return bytes == this->volume->BlockSize();
+    if (this->memory && this->memory->Put(it->second, buffer, true))
+    {
+      return true;
+    }
+
+    return pwrite(this->slabFile, buffer, blockSize, static_cast<off_t>(it->second * blockSize)) == static_cast<ssize_t>(blockSize);
   }
 
 
-  void Cache::UpdateTimestamp(uint64_t row, bool setDirty)
+  void Cache::ReleaseSlots(Worker & worker, uint64_t row)
   {
-    uint64_t now = static_cast<uint64_t>(time(nullptr));
-
-    auto itr = this->items.find(row);
-    if (itr != this->items.end())
+    for (uint64_t column = 0; column < this->volume->Columns(); ++column)
     {
-      auto range = this->timestamps.equal_range(itr->second.timestamp);
-      for (auto it = range.first; it != range.second; ++it)
+      uint64_t key = row * this->volume->Columns() + column;
+
+      auto it = worker.slots.find(key);
+      if (it != worker.slots.end())
       {
-        if (it->second == row)
+        if (this->memory)
         {
-          this->timestamps.erase(it);
-          break;
+          this->memory->Erase(it->second);
         }
-      }
 
-      itr->second.timestamp = now;
-      if (setDirty)
-      {
-        itr->second.dirty = true;
+        {
+          std::unique_lock<std::mutex> lock(this->slabMutex);
+          this->freeSlots.push_back(it->second);
+        }
+
+        worker.slots.erase(it);
       }
     }
-    else
+  }
+
+
+  bool Cache::DemoteSlot(uint64_t slot, const uint8_t * block)
+  {
+    size_t blockSize = this->volume->BlockSize();
+
+    if (pwrite(this->slabFile, block, blockSize, static_cast<off_t>(slot * blockSize)) != static_cast<ssize_t>(blockSize))
     {
-      this->items[row] = {
-        .timestamp = now,
-        .dirty = setDirty
-      };
+      printf("Error: failed to move a cell out of the memory cache: slot=%llu\n", (long long unsigned)slot);
+      return false;
     }
 
-    this->timestamps.emplace(now, row);
+    return true;
+  }
+
+
+  // Only grows past its initial size while dirty rows can't be written
+  // back and so can't be evicted either. Called with 'slabMutex' held.
+  bool Cache::GrowSlab(size_t count)
+  {
+    size_t blockSize = this->volume->BlockSize();
+    off_t size = static_cast<off_t>((this->slabSlots + count) * blockSize);
+
+    if (posix_fallocate(this->slabFile, 0, size) != 0 && ftruncate(this->slabFile, size) != 0)
+    {
+      printf("Error: failed to grow the cache file to %lu bytes.\n", (unsigned long)size);
+      return false;
+    }
+
+    // Lower slots are handed out first
+    for (size_t slot = this->slabSlots + count; slot > this->slabSlots; --slot)
+    {
+      this->freeSlots.push_back(slot - 1);
+    }
+
+    this->slabSlots += count;
+
+    return true;
+  }
+
+
+  bool Cache::Admit(Worker & worker, uint64_t row)
+  {
+    return worker.items.count(row) > 0 || worker.items.size() < worker.limit || worker.policy->Admit(row);
+  }
+
+
+  size_t Cache::RowBytes(Worker & worker, uint64_t row)
+  {
+    size_t count = 0;
+
+    for (uint64_t column = 0; column < this->volume->Columns(); ++column)
+    {
+      count += worker.slots.count(row * this->volume->Columns() + column);
+    }
+
+    return count * this->volume->BlockSize();
+  }
+
+
+  void Cache::Touch(Worker & worker, uint64_t row, bool setDirty, bool used)
+  {
+    auto itr = worker.items.find(row);
+    if (itr == worker.items.end())
+    {
+      itr = worker.items.emplace(row, Item()).first;
+      worker.policy->Insert(row, used);
+    }
+
+    if (setDirty)
+    {
+      // Cells are only added to a row while it is cached, so its count
+      // only grows until it is clean again
+      size_t bytes = this->RowBytes(worker, row);
+      this->dirtyBytes += bytes - itr->second.bytes;
+
+      itr->second.bytes = bytes;
+      itr->second.dirty = true;
+      itr->second.queued = false;
+      itr->second.version = ++this->versions;
+    }
 
-    if (this->items.size() > this->limit)
+    if (worker.items.size() > worker.limit)
     {
-      this->Pop();
+      this->Pop(worker);
     }
   }
 }
@@ -24,33 +24,63 @@
 
 #include <stdint.h>
 #include <string>
-#include <map>
+#include <unordered_map>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
 #include <memory>
+#include <vector>
 #include "LockFreeQueue.h"
 #include "AsyncResult.h"
+#include "MemoryCache.h"
+#include "CachePolicy.h"
+#include "WriteBack.h"
 
 namespace dfs
 {
   class Volume;
 
+  struct CellIo;
+
   class Cache
   {
   private:
 
     struct Item
     {
-      uint64_t timestamp = 0;
       bool dirty = false;
+
+      // Changes with every write, so that the outcome of a write-back is
+      // only applied if the row wasn't written again since it was handed over.
+      uint64_t version = 0;
+
+      // Handed to the write-back as of 'version'
+      bool queued = false;
+
+      // Last version known to be on the partitions
+      uint64_t stored = 0;
+
+      // Counted in 'dirtyBytes' for the row
+      size_t bytes = 0;
+    };
+
+    struct Written
+    {
+      uint64_t row;
+      uint64_t version;
+      bool success;
     };
 
     enum class RequestType
     {
       Read,
-      Write
+      Write,
+      ReadCells,
+      WriteCells,
+      FillCells,
+      Discard,
+      Sync
     };
 
     struct Request
@@ -101,10 +131,99 @@ namespace dfs
       bdfs::AsyncResult<bool> result;
     };
 
+    struct CellsRequest : public Request
+    {
+      CellsRequest(RequestType type, uint64_t row, std::vector<CellIo> & cells)
+        : Request(type)
+        , row(row)
+        , cells(cells)
+      {
+      }
+
+      uint64_t row;
+      std::vector<CellIo> & cells;
+      uint64_t epoch = 0;
+      bdfs::AsyncResult<bool> result;
+    };
+
+    struct DiscardRequest : public Request
+    {
+      explicit DiscardRequest(uint64_t row)
+        : Request(RequestType::Discard)
+        , row(row)
+      {
+      }
+
+      uint64_t row;
+      bdfs::AsyncResult<bool> result;
+    };
+
+    struct SyncRequest : public Request
+    {
+      SyncRequest()
+        : Request(RequestType::Sync)
+      {
+      }
+
+      bdfs::AsyncResult<bool> result;
+    };
+
+    // Syncs that arrived together, waiting for the versions of the rows that
+    // were dirty then to be written back.
+    struct PendingSync
+    {
+      std::vector<SyncRequest *> requests;
+      std::unordered_map<uint64_t, uint64_t> rows;
+      bool success = true;
+    };
+
+    // Rows are spread over the workers by row number. Each worker serves
+    // the requests for its rows from its own queue and holds its share of
+    // the rows the cache keeps, so a miss only holds up rows of the same
+    // worker and misses of different workers go out in parallel.
+    struct Worker
+    {
+      bdfs::LockFreeQueue<Request *> requests;
+
+      std::thread thread;
+
+      std::mutex mutex;
+
+      std::condition_variable cond;
+
+      std::atomic<bool> hasNotification{false};
+
+      // Write-backs of its rows that ended, guarded by 'mutex'
+      std::vector<Written> written;
+
+      std::vector<PendingSync> syncs;
+
+      size_t limit = 0;
+
+      std::unordered_map<uint64_t, Item> items;
+
+      std::unique_ptr<CachePolicy> policy;
+
+      // Slot of each cell, by row * columns + column
+      std::unordered_map<uint64_t, size_t> slots;
+
+      // Value of 'evictions' when a row hashing to the slot was last evicted
+      std::vector<uint64_t> evicted;
+    };
+
 
   public:
 
-    explicit Cache(std::string rootPath, Volume * volume, size_t limit, uint32_t flushPolicy = 60);
+    // With 'memoryLimit' bytes, the most recently used cells are also kept
+    // in memory, in front of the cache files. 'policy' picks the rows to
+    // evict, see CachePolicy::Create. Requests are served by 'workers'
+    // threads, each for its own share of the rows. Dirty rows are written
+    // back in the background with at most 'hostUploads' cells going to the
+    // same host at a time, see WriteBack; the transport serves a host one
+    // request at a time, so more only wait in its queue. Writers are held
+    // back while more than 'dirtyLimit' bytes (0 for no limit) are dirty.
+    explicit Cache(std::string rootPath, Volume * volume, size_t limit, uint32_t flushPolicy = 60, size_t memoryLimit = 0,
+                   const std::string & policy = "tinylfu", size_t workers = 1, size_t hostUploads = 1, size_t dirtyLimit = 0);
 
     ~Cache();
 
@@ -112,49 +231,129 @@ namespace dfs
 
     bool Write(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
 
+    bool Read(uint64_t row, std::vector<CellIo> & cells);
+
+    bool Write(uint64_t row, std::vector<CellIo> & cells);
+
+    // Adds clean cells read from the partitions while Evictions() was
+    // 'epoch'. Cells the cache already holds are left alone, and nothing is
+    // added if the row was evicted in the meantime, since the cells might
+    // then have been written and flushed after they were read.
+    bool Fill(uint64_t row, std::vector<CellIo> & cells, uint64_t epoch);
+
+    uint64_t Evictions() const { return evictions; }
+
+    const MemoryCache * GetMemory() const { return memory.get(); }
+
+    // Bytes of the rows not written back yet, every cell of them included.
+    size_t DirtyBytes() const { return dirtyBytes; }
+
+    // Drops the row, dirty cells included, for rows that were trimmed.
+    bool Discard(uint64_t row);
+
+    // Writes back every row dirtied before the call. Calls that arrive
+    // together are served together, and requests that follow them are
+    // served while the rows go out.
+    bool Sync();
+
   private:
 
-    void ThreadProc();
+    Worker & GetWorker(uint64_t row) { return *workers[row % workers.size()]; }
+
+    void ThreadProc(Worker & worker);
+
+    bool ReadImpl(Worker & worker, uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
+
+    bool WriteImpl(Worker & worker, uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
+
+    bool ReadImpl(Worker & worker, uint64_t row, std::vector<CellIo> & cells);
 
-    bool ReadImpl(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
+    bool WriteImpl(Worker & worker, uint64_t row, std::vector<CellIo> & cells);
 
-    bool WriteImpl(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
+    bool FillImpl(Worker & worker, uint64_t row, std::vector<CellIo> & cells, uint64_t epoch);
 
-    bool ReadFileBlock(const char * filename, uint64_t column, void * buffer);
+    bool DiscardImpl(Worker & worker, uint64_t row);
 
-    bool WriteFileBlock(const char * filename, uint64_t column, const void * buffer);
+    bool Post(Worker & worker, Request * req);
 
-    void UpdateTimestamp(uint64_t row, bool setDirty);
+    bool Submit(Worker & worker, Request * req, bdfs::AsyncResult<bool> & result);
 
-    void Pop();
+    // Waits while more than 'dirtyLimit' bytes are dirty.
+    void Throttle();
 
-    bool Flush(bool force = false);
+    // Cells read from the slab are moved up to memory unless 'promote' is
+    // false.
+    bool ReadSlot(Worker & worker, uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset, bool promote = true);
+
+    bool WriteSlot(Worker & worker, uint64_t row, uint64_t column, const void * buffer);
+
+    void ReleaseSlots(Worker & worker, uint64_t row);
+
+    bool DemoteSlot(uint64_t slot, const uint8_t * block);
+
+    bool GrowSlab(size_t count);
+
+    // Whether cells read from the partitions for the row should be kept.
+    // Cells that are written always are.
+    bool Admit(Worker & worker, uint64_t row);
+
+    // Records that cells of the row were added to the cache.
+    void Touch(Worker & worker, uint64_t row, bool setDirty, bool used = true);
+
+    void Pop(Worker & worker);
+
+    // Hands the dirty rows to the write-back.
+    bool Flush(Worker & worker, bool force = false);
+
+    size_t RowBytes(Worker & worker, uint64_t row);
+
+    void MarkClean(Item & item);
+
+    // Called from the write-back threads.
+    void OnWritten(uint64_t row, uint64_t version, bool success);
+
+    void CollectWritten(Worker & worker);
+
+    void CompleteSyncs(Worker & worker);
 
   private:
 
     std::string rootPath;
 
-    size_t limit;
-
     uint32_t flushPolicy;
 
     Volume * volume;
 
-    bdfs::LockFreeQueue<Request *> requests;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // Cells live in fixed size slots of a single file shared by the
+    // workers. Freed slots are reused before the file grows.
+    int slabFile = -1;
+
+    std::mutex slabMutex;
 
-    std::multimap<uint64_t, uint64_t> timestamps;
+    size_t slabSlots = 0;
 
-    std::map<uint64_t, Item> items;
+    std::vector<size_t> freeSlots;
 
-    std::mutex mutex;
+    // Cells written to memory, by slot, only reach the slot when they are
+    // evicted from it.
+    std::unique_ptr<MemoryCache> memory;
 
-    std::thread thread;
+    std::unique_ptr<WriteBack> writeBack;
 
-    std::condition_variable cond;
+    size_t dirtyLimit;
+
+    std::atomic<size_t> dirtyBytes{0};
+
+    std::atomic<uint64_t> versions{0};
+
+    std::mutex throttleMutex;
+
+    std::condition_variable throttleCond;
 
     std::atomic<bool> active;
 
-    std::atomic<bool> hasNotification{false};
+    std::atomic<uint64_t> evictions{0};
   };
 }
-
@@ -0,0 +1,282 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "CachePolicy.h"
+
+#include <algorithm>
+
+namespace dfs
+{
+  std::unique_ptr<CachePolicy> CachePolicy::Create(const std::string & name, size_t capacity)
+  {
+    if (name == "lru")
+    {
+      return std::unique_ptr<CachePolicy>(new LruPolicy());
+    }
+    else if (name == "slru")
+    {
+      return std::unique_ptr<CachePolicy>(new SlruPolicy(capacity, false));
+    }
+    else if (name == "tinylfu")
+    {
+      return std::unique_ptr<CachePolicy>(new SlruPolicy(capacity, true));
+    }
+
+    return nullptr;
+  }
+
+
+  FrequencySketch::FrequencySketch(size_t capacity)
+  {
+    // A few counters per cached row keeps collisions rare
+    size_t width = 64;
+    while (width < capacity * 4)
+    {
+      width <<= 1;
+    }
+
+    this->counters.resize(width * DEPTH, 0);
+    this->mask = width - 1;
+    this->sampleSize = std::max<size_t>(capacity, 8) * 10;
+  }
+
+
+  size_t FrequencySketch::Index(uint64_t row, int depth) const
+  {
+    static const uint64_t SEEDS[DEPTH] = {
+      0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull
+    };
+
+    uint64_t hash = (row + 1) * SEEDS[depth];
+    hash ^= hash >> 29;
+
+    return static_cast<size_t>(depth) * (this->mask + 1) + (hash & this->mask);
+  }
+
+
+  void FrequencySketch::Increment(uint64_t row)
+  {
+    bool added = false;
+
+    for (int i = 0; i < DEPTH; ++i)
+    {
+      uint8_t & counter = this->counters[this->Index(row, i)];
+      if (counter < MAX_COUNT)
+      {
+        ++counter;
+        added = true;
+      }
+    }
+
+    if (added && ++this->additions >= this->sampleSize)
+    {
+      this->Reset();
+    }
+  }
+
+
+  uint32_t FrequencySketch::Frequency(uint64_t row) const
+  {
+    uint32_t result = MAX_COUNT;
+
+    for (int i = 0; i < DEPTH; ++i)
+    {
+      result = std::min<uint32_t>(result, this->counters[this->Index(row, i)]);
+    }
+
+    return result;
+  }
+
+
+  void FrequencySketch::Reset()
+  {
+    for (auto & counter : this->counters)
+    {
+      counter >>= 1;
+    }
+
+    this->additions /= 2;
+  }
+
+
+  void LruPolicy::Access(uint64_t row)
+  {
+    auto it = this->index.find(row);
+    if (it != this->index.end())
+    {
+      this->lru.splice(this->lru.begin(), this->lru, it->second);
+    }
+  }
+
+
+  void LruPolicy::Insert(uint64_t row, bool used)
+  {
+    if (this->index.count(row) == 0)
+    {
+      this->lru.push_front(row);
+      this->index[row] = this->lru.begin();
+    }
+  }
+
+
+  void LruPolicy::Erase(uint64_t row)
+  {
+    auto it = this->index.find(row);
+    if (it != this->index.end())
+    {
+      this->lru.erase(it->second);
+      this->index.erase(it);
+    }
+  }
+
+
+  void LruPolicy::Victims(const std::function<bool(uint64_t row)> & visit) const
+  {
+    for (auto it = this->lru.rbegin(); it != this->lru.rend(); ++it)
+    {
+      if (!visit(*it))
+      {
+        return;
+      }
+    }
+  }
+
+
+  SlruPolicy::SlruPolicy(size_t capacity, bool admission)
+    : protectedCapacity(capacity * 4 / 5)
+  {
+    if (admission)
+    {
+      this->sketch.reset(new FrequencySketch(capacity));
+    }
+  }
+
+
+  void SlruPolicy::Access(uint64_t row)
+  {
+    this->repeated = (row == this->last);
+    if (this->repeated)
+    {
+      return;
+    }
+
+    this->last = row;
+
+    if (this->sketch)
+    {
+      this->sketch->Increment(row);
+    }
+
+    auto it = this->index.find(row);
+    if (it == this->index.end())
+    {
+      return;
+    }
+
+    auto node = it->second;
+
+    if (node->protect)
+    {
+      this->protect.splice(this->protect.begin(), this->protect, node);
+      return;
+    }
+
+    if (!node->used || this->protectedCapacity == 0)
+    {
+      node->used = true;
+      this->probation.splice(this->probation.begin(), this->probation, node);
+      return;
+    }
+
+    node->protect = true;
+    this->protect.splice(this->protect.begin(), this->probation, node);
+
+    if (this->protect.size() > this->protectedCapacity)
+    {
+      auto demoted = std::prev(this->protect.end());
+      demoted->protect = false;
+      this->probation.splice(this->probation.begin(), this->protect, demoted);
+    }
+  }
+
+
+  void SlruPolicy::Insert(uint64_t row, bool used)
+  {
+    if (this->index.count(row) == 0)
+    {
+      this->probation.push_front({row, false, used});
+      this->index[row] = this->probation.begin();
+    }
+  }
+
+
+  void SlruPolicy::Erase(uint64_t row)
+  {
+    auto it = this->index.find(row);
+    if (it != this->index.end())
+    {
+      (it->second->protect ? this->protect : this->probation).erase(it->second);
+      this->index.erase(it);
+    }
+  }
+
+
+  bool SlruPolicy::Admit(uint64_t row)
+  {
+    if (!this->sketch || this->repeated)
+    {
+      return true;
+    }
+
+    const Node * victim = nullptr;
+    if (!this->probation.empty())
+    {
+      victim = &this->probation.back();
+    }
+    else if (!this->protect.empty())
+    {
+      victim = &this->protect.back();
+    }
+
+    return !victim || this->sketch->Frequency(row) >= this->sketch->Frequency(victim->row);
+  }
+
+
+  void SlruPolicy::Victims(const std::function<bool(uint64_t row)> & visit) const
+  {
+    for (auto it = this->probation.rbegin(); it != this->probation.rend(); ++it)
+    {
+      if (!visit(it->row))
+      {
+        return;
+      }
+    }
+
+    for (auto it = this->protect.rbegin(); it != this->protect.rend(); ++it)
+    {
+      if (!visit(it->row))
+      {
+        return;
+      }
+    }
+  }
+}
@@ -0,0 +1,183 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dfs
+{
+  // Decides which cached rows the cache evicts first and whether a row read
+  // from the partitions is worth caching at all. Every operation is O(1),
+  // apart from visiting victims past ones that can't be evicted.
+  class CachePolicy
+  {
+  public:
+
+    virtual ~CachePolicy() = default;
+
+    virtual const char * Name() const = 0;
+
+    // Called for every read or write of the row, cached or not.
+    virtual void Access(uint64_t row) = 0;
+
+    // The row was added to the cache. 'used' is false for rows added by
+    // read-ahead, so that the read that follows counts as their first use.
+    virtual void Insert(uint64_t row, bool used) = 0;
+
+    virtual void Erase(uint64_t row) = 0;
+
+    // Whether the row should take the place of the next victim once the
+    // cache is full.
+    virtual bool Admit(uint64_t row) { return true; }
+
+    // Visits cached rows in the order they should be evicted, until 'visit'
+    // returns false.
+    virtual void Victims(const std::function<bool(uint64_t row)> & visit) const = 0;
+
+    // Returns "lru", "slru" or "tinylfu" for 'capacity' rows, or nullptr for
+    // an unknown name.
+    static std::unique_ptr<CachePolicy> Create(const std::string & name, size_t capacity);
+  };
+
+
+  // Approximate access counts of recent rows in a count-min sketch of small
+  // saturating counters, all halved after every 'sampleSize' accesses so
+  // that old popularity fades.
+  class FrequencySketch
+  {
+  public:
+
+    explicit FrequencySketch(size_t capacity);
+
+    void Increment(uint64_t row);
+
+    uint32_t Frequency(uint64_t row) const;
+
+  private:
+
+    static const int DEPTH = 4;
+
+    static const uint8_t MAX_COUNT = 15;
+
+    size_t Index(uint64_t row, int depth) const;
+
+    void Reset();
+
+  private:
+
+    std::vector<uint8_t> counters;
+
+    size_t mask;
+
+    size_t sampleSize;
+
+    size_t additions = 0;
+  };
+
+
+  // Plain least recently used.
+  class LruPolicy : public CachePolicy
+  {
+  public:
+
+    const char * Name() const override { return "lru"; }
+
+    void Access(uint64_t row) override;
+
+    void Insert(uint64_t row, bool used) override;
+
+    void Erase(uint64_t row) override;
+
+    void Victims(const std::function<bool(uint64_t row)> & visit) const override;
+
+  private:
+
+    std::list<uint64_t> lru;
+
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> index;
+  };
+
+
+  // Segmented LRU. New rows go to a probation segment and only move to the
+  // protected one, which holds most of the cache, once used again. Rows
+  // pushed out of the protected segment get another round in probation, and
+  // victims come from probation first, so a scan that touches every row
+  // once cycles through probation and leaves the protected rows alone.
+  // Back to back accesses to the same row, such as the small reads that
+  // make up a sequential read of a row, count as one.
+  //
+  // With 'admission' (TinyLFU), a row that is not cached is only admitted
+  // if it was accessed at least as often recently as the victim it would
+  // evict, or if it is being accessed again right away, as a sequential
+  // read of the row would.
+  class SlruPolicy : public CachePolicy
+  {
+  public:
+
+    SlruPolicy(size_t capacity, bool admission);
+
+    const char * Name() const override { return sketch ? "tinylfu" : "slru"; }
+
+    void Access(uint64_t row) override;
+
+    void Insert(uint64_t row, bool used) override;
+
+    void Erase(uint64_t row) override;
+
+    bool Admit(uint64_t row) override;
+
+    void Victims(const std::function<bool(uint64_t row)> & visit) const override;
+
+  private:
+
+    struct Node
+    {
+      uint64_t row;
+      bool protect;
+      bool used;
+    };
+
+  private:
+
+    size_t protectedCapacity;
+
+    std::list<Node> probation;
+
+    std::list<Node> protect;
+
+    std::unordered_map<uint64_t, std::list<Node>::iterator> index;
+
+    std::unique_ptr<FrequencySketch> sketch;
+
+    uint64_t last = UINT64_MAX;
+
+    bool repeated = false;
+  };
+}
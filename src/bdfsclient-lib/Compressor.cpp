@@ -0,0 +1,108 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "Compressor.h"
+
+#include <lz4.h>
+#include <zstd.h>
+
+namespace dfs
+{
+  class Lz4Compressor : public Compressor
+  {
+  public:
+
+    const char * Name() const override { return "lz4"; }
+
+    uint8_t Id() const override { return 1; }
+
+    size_t Compress(const uint8_t * in, size_t size, uint8_t * out, size_t capacity) const override
+    {
+      int rtn = LZ4_compress_default(reinterpret_cast<const char *>(in), reinterpret_cast<char *>(out), static_cast<int>(size), static_cast<int>(capacity));
+      return rtn > 0 ? static_cast<size_t>(rtn) : 0;
+    }
+
+    bool Decompress(const uint8_t * in, size_t inSize, uint8_t * out, size_t size) const override
+    {
+      int rtn = LZ4_decompress_safe(reinterpret_cast<const char *>(in), reinterpret_cast<char *>(out), static_cast<int>(inSize), static_cast<int>(size));
+      return rtn >= 0 && static_cast<size_t>(rtn) == size;
+    }
+  };
+
+
+  class ZstdCompressor : public Compressor
+  {
+  public:
+
+    // Favours speed, cells are compressed on the write path
+    static const int LEVEL = 1;
+
+    const char * Name() const override { return "zstd"; }
+
+    uint8_t Id() const override { return 2; }
+
+    size_t Compress(const uint8_t * in, size_t size, uint8_t * out, size_t capacity) const override
+    {
+      size_t rtn = ZSTD_compress(out, capacity, in, size, LEVEL);
+      return ZSTD_isError(rtn) ? 0 : rtn;
+    }
+
+    bool Decompress(const uint8_t * in, size_t inSize, uint8_t * out, size_t size) const override
+    {
+      size_t rtn = ZSTD_decompress(out, size, in, inSize);
+      return !ZSTD_isError(rtn) && rtn == size;
+    }
+  };
+
+
+  static const Lz4Compressor lz4;
+  static const ZstdCompressor zstd;
+  static const Compressor * const compressors[] = { &lz4, &zstd };
+
+
+  const Compressor * Compressor::Get(const std::string & name)
+  {
+    for (auto compressor : compressors)
+    {
+      if (name == compressor->Name())
+      {
+        return compressor;
+      }
+    }
+
+    return nullptr;
+  }
+
+
+  const Compressor * Compressor::Get(uint8_t id)
+  {
+    for (auto compressor : compressors)
+    {
+      if (id == compressor->Id())
+      {
+        return compressor;
+      }
+    }
+
+    return nullptr;
+  }
+}
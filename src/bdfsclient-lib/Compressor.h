@@ -0,0 +1,56 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace dfs
+{
+  // Lossless codecs for the cells written by WriteEncrypt, chosen per volume
+  // as "compression" in volume.conf.
+  class Compressor
+  {
+  public:
+
+    virtual ~Compressor() = default;
+
+    virtual const char * Name() const = 0;
+
+    // Recorded in every compressed cell, so cells stay readable after the
+    // volume switches codecs.
+    virtual uint8_t Id() const = 0;
+
+    // Returns the compressed size, or 0 if it does not fit in 'capacity'.
+    virtual size_t Compress(const uint8_t * in, size_t size, uint8_t * out, size_t capacity) const = 0;
+
+    // Fails unless exactly 'size' bytes come out.
+    virtual bool Decompress(const uint8_t * in, size_t inSize, uint8_t * out, size_t size) const = 0;
+
+    // Returns "lz4" or "zstd", or nullptr for an unknown name.
+    static const Compressor * Get(const std::string & name);
+
+    static const Compressor * Get(uint8_t id);
+  };
+}
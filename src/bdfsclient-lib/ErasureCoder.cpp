@@ -0,0 +1,567 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "ErasureCoder.h"
+#include "ErasureKernels.h"
+#include "cm256.h"
+
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace dfs
+{
+  namespace
+  {
+    // Encode works on slices of this size across all blocks of the row, so
+    // the code slices stay in L1 while every data slice is added to them.
+    const size_t ENCODE_SLICE = 8 * 1024;
+
+    // Number of erasure patterns whose decode matrix is kept.
+    const size_t DECODE_MATRIX_LIMIT = 128;
+
+    using Kernel = void (*)(uint8_t *, const uint8_t *, uint8_t, size_t);
+
+    class KernelCoder : public ErasureCoder
+    {
+    public:
+
+      KernelCoder(const char * name, Kernel mulAdd, Kernel mul)
+        : name(name)
+        , mulAdd(mulAdd)
+        , mul(mul)
+      {
+      }
+
+      const char * Name() const override { return name; }
+
+      void MulAdd(uint8_t * z, const uint8_t * x, uint8_t c, size_t size) const override
+      {
+        mulAdd(z, x, c, size);
+      }
+
+      void Mul(uint8_t * z, const uint8_t * x, uint8_t c, size_t size) const override
+      {
+        mul(z, x, c, size);
+      }
+
+    private:
+
+      const char * name;
+
+      Kernel mulAdd;
+
+      Kernel mul;
+    };
+
+
+    // Compatibility mode: encodes and decodes through the cm256 library itself.
+    class Cm256Coder : public KernelCoder
+    {
+    public:
+
+      Cm256Coder()
+        : KernelCoder("cm256", ErasureKernels::MulAddScalar, ErasureKernels::MulScalar)
+      {
+      }
+
+      bool Encode(uint64_t dataCount, uint64_t codeCount, const ErasureBlock * data, void * code, size_t blockSize) const override
+      {
+        cm256_encoder_params params;
+        params.BlockBytes = blockSize;
+        params.OriginalCount = dataCount;
+        params.RecoveryCount = codeCount;
+
+        cm256_block blocks[256] = {0};
+        for (uint64_t i = 0; i < dataCount; ++i)
+        {
+          blocks[i].Block = data[i].buffer;
+          blocks[i].Index = data[i].index;
+        }
+
+        return cm256_encode(params, blocks, code) == 0;
+      }
+
+      bool Decode(uint64_t dataCount, uint64_t codeCount, ErasureBlock * blocks, size_t blockSize) const override
+      {
+        cm256_encoder_params params;
+        params.BlockBytes = blockSize;
+        params.OriginalCount = dataCount;
+        params.RecoveryCount = codeCount;
+
+        cm256_block cmBlocks[256] = {0};
+        for (uint64_t i = 0; i < dataCount; ++i)
+        {
+          cmBlocks[i].Block = blocks[i].buffer;
+          cmBlocks[i].Index = blocks[i].index;
+        }
+
+        if (cm256_decode(params, cmBlocks))
+        {
+          return false;
+        }
+
+        for (uint64_t i = 0; i < dataCount; ++i)
+        {
+          blocks[i].index = cmBlocks[i].Index;
+        }
+
+        return true;
+      }
+    };
+
+
+    struct CpuFeatures
+    {
+      bool ssse3 = false;
+      bool avx2 = false;
+      bool avx512 = false;
+      bool gfni = false;
+    };
+
+
+    CpuFeatures DetectCpu()
+    {
+      CpuFeatures features;
+
+#if defined(__x86_64__) || defined(__i386__)
+      unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+      if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      {
+        return features;
+      }
+
+      features.ssse3 = (ecx & bit_SSSE3) != 0;
+
+      // The OS has to save the vector registers as well, see XCR0.
+      uint64_t xcr0 = 0;
+      if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+      {
+        uint32_t low = 0, high = 0;
+        __asm__ ("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+        xcr0 = (static_cast<uint64_t>(high) << 32) | low;
+      }
+
+      bool ymm = (xcr0 & 0x06) == 0x06;
+      bool zmm = ymm && (xcr0 & 0xe0) == 0xe0;
+
+      if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+      {
+        features.avx2 = ymm && (ebx & bit_AVX2);
+        features.avx512 = zmm && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW);
+        features.gfni = (ecx & bit_GFNI) != 0;
+      }
+#endif
+
+      return features;
+    }
+
+
+    uint8_t GfMul(uint8_t a, uint8_t b)
+    {
+      return GfTables::Get().mul[a][b];
+    }
+
+
+    uint8_t GfInv(uint8_t a)
+    {
+      const GfTables & t = GfTables::Get();
+      return t.exp[255 - t.log[a]];
+    }
+
+
+    // Inverts the n x n 'matrix' into 'inverse' with Gauss-Jordan elimination.
+    bool Invert(std::vector<uint8_t> & matrix, std::vector<uint8_t> & inverse, size_t n)
+    {
+      inverse.assign(n * n, 0);
+      for (size_t i = 0; i < n; ++i)
+      {
+        inverse[i * n + i] = 1;
+      }
+
+      for (size_t col = 0; col < n; ++col)
+      {
+        size_t pivot = col;
+        while (pivot < n && matrix[pivot * n + col] == 0)
+        {
+          ++pivot;
+        }
+
+        if (pivot == n)
+        {
+          return false;
+        }
+
+        if (pivot != col)
+        {
+          std::swap_ranges(matrix.begin() + pivot * n, matrix.begin() + (pivot + 1) * n, matrix.begin() + col * n);
+          std::swap_ranges(inverse.begin() + pivot * n, inverse.begin() + (pivot + 1) * n, inverse.begin() + col * n);
+        }
+
+        uint8_t scale = GfInv(matrix[col * n + col]);
+        for (size_t j = 0; j < n; ++j)
+        {
+          matrix[col * n + j] = GfMul(matrix[col * n + j], scale);
+          inverse[col * n + j] = GfMul(inverse[col * n + j], scale);
+        }
+
+        for (size_t row = 0; row < n; ++row)
+        {
+          uint8_t factor = matrix[row * n + col];
+          if (row == col || factor == 0)
+          {
+            continue;
+          }
+
+          for (size_t j = 0; j < n; ++j)
+          {
+            matrix[row * n + j] ^= GfMul(factor, matrix[col * n + j]);
+            inverse[row * n + j] ^= GfMul(factor, inverse[col * n + j]);
+          }
+        }
+      }
+
+      return true;
+    }
+
+
+    // Inverted decode matrices, least recently used first out. The key is
+    // the data count and the bitmap of the columns that are available, which
+    // is the same for every row read while the same providers are down.
+    class DecodeMatrixCache
+    {
+    public:
+
+      using Key = std::pair<uint64_t, std::array<uint64_t, 4>>;
+
+      explicit DecodeMatrixCache(size_t limit)
+        : limit(limit)
+      {
+      }
+
+      bool Get(const Key & key, std::vector<uint8_t> & inverse)
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+
+        auto itr = this->items.find(key);
+        if (itr == this->items.end())
+        {
+          return false;
+        }
+
+        this->order.splice(this->order.begin(), this->order, itr->second.second);
+        inverse = itr->second.first;
+        return true;
+      }
+
+      void Put(const Key & key, const std::vector<uint8_t> & inverse)
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+
+        if (this->items.find(key) != this->items.end())
+        {
+          return;
+        }
+
+        this->order.push_front(key);
+        this->items.emplace(key, std::make_pair(inverse, this->order.begin()));
+
+        if (this->items.size() > this->limit)
+        {
+          this->items.erase(this->order.back());
+          this->order.pop_back();
+        }
+      }
+
+      static DecodeMatrixCache & Instance()
+      {
+        static DecodeMatrixCache instance(DECODE_MATRIX_LIMIT);
+        return instance;
+      }
+
+    private:
+
+      std::mutex mutex;
+
+      size_t limit;
+
+      std::list<Key> order;
+
+      std::map<Key, std::pair<std::vector<uint8_t>, std::list<Key>::iterator>> items;
+    };
+  }
+
+
+  uint8_t ErasureCoder::Coefficient(uint64_t dataCount, uint64_t code, uint64_t data)
+  {
+    if (dataCount == 1)
+    {
+      return 1;
+    }
+
+    // Cauchy matrix whose first row is normalized to all ones, as in cm256.
+    uint8_t x0 = static_cast<uint8_t>(dataCount);
+    uint8_t xi = static_cast<uint8_t>(dataCount + code);
+    uint8_t yj = static_cast<uint8_t>(data);
+
+    return GfMul(yj ^ x0, GfInv(xi ^ yj));
+  }
+
+
+  bool ErasureCoder::Encode(uint64_t dataCount, uint64_t codeCount, const ErasureBlock * data, void * code, size_t blockSize) const
+  {
+    if (dataCount == 0 || dataCount + codeCount > 256)
+    {
+      return false;
+    }
+
+    uint8_t * out = static_cast<uint8_t *>(code);
+
+    for (size_t offset = 0; offset < blockSize; offset += ENCODE_SLICE)
+    {
+      size_t size = std::min(ENCODE_SLICE, blockSize - offset);
+
+      for (uint64_t j = 0; j < dataCount; ++j)
+      {
+        const uint8_t * x = static_cast<const uint8_t *>(data[j].buffer) + offset;
+
+        for (uint64_t i = 0; i < codeCount; ++i)
+        {
+          uint8_t * z = out + (i * blockSize) + offset;
+          uint8_t c = Coefficient(dataCount, i, j);
+
+          if (j == 0)
+          {
+            Mul(z, x, c, size);
+          }
+          else
+          {
+            MulAdd(z, x, c, size);
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+
+  bool ErasureCoder::Decode(uint64_t dataCount, uint64_t codeCount, ErasureBlock * blocks, size_t blockSize) const
+  {
+    if (dataCount == 0 || dataCount + codeCount > 256)
+    {
+      return false;
+    }
+
+    bool present[256] = {false};
+    std::vector<size_t> recovery;
+
+    for (uint64_t i = 0; i < dataCount; ++i)
+    {
+      uint64_t index = blocks[i].index;
+      if (index >= dataCount + codeCount)
+      {
+        return false;
+      }
+
+      if (index < dataCount)
+      {
+        if (present[index])
+        {
+          return false;
+        }
+        present[index] = true;
+      }
+      else
+      {
+        recovery.push_back(i);
+      }
+    }
+
+    std::vector<uint64_t> erasures;
+    for (uint64_t i = 0; i < dataCount; ++i)
+    {
+      if (!present[i])
+      {
+        erasures.push_back(i);
+      }
+    }
+
+    size_t count = erasures.size();
+    if (count == 0)
+    {
+      return true;
+    }
+
+    if (count != recovery.size())
+    {
+      return false;
+    }
+
+    // The matrix only depends on which columns are there, so build it from
+    // the code blocks in column order and reuse it for the same pattern.
+    std::vector<size_t> sources = recovery;
+    std::sort(sources.begin(), sources.end(), [blocks](size_t a, size_t b) { return blocks[a].index < blocks[b].index; });
+
+    DecodeMatrixCache::Key key(dataCount, {{0, 0, 0, 0}});
+    for (uint64_t i = 0; i < dataCount; ++i)
+    {
+      key.second[blocks[i].index / 64] |= (1ull << (blocks[i].index % 64));
+    }
+
+    std::vector<uint8_t> inverse;
+
+    if (!DecodeMatrixCache::Instance().Get(key, inverse))
+    {
+      std::vector<uint8_t> matrix(count * count);
+
+      for (size_t a = 0; a < count; ++a)
+      {
+        for (size_t b = 0; b < count; ++b)
+        {
+          matrix[a * count + b] = Coefficient(dataCount, blocks[sources[a]].index - dataCount, erasures[b]);
+        }
+      }
+
+      if (!Invert(matrix, inverse, count))
+      {
+        return false;
+      }
+
+      DecodeMatrixCache::Instance().Put(key, inverse);
+    }
+
+    // Take the known data blocks out of the code blocks, which leaves only
+    // the share of the missing ones.
+    for (auto r : recovery)
+    {
+      uint8_t * z = static_cast<uint8_t *>(blocks[r].buffer);
+      uint64_t code = blocks[r].index - dataCount;
+
+      for (uint64_t i = 0; i < dataCount; ++i)
+      {
+        if (blocks[i].index < dataCount)
+        {
+          MulAdd(z, static_cast<const uint8_t *>(blocks[i].buffer), Coefficient(dataCount, code, blocks[i].index), blockSize);
+        }
+      }
+    }
+
+    if (count == 1)
+    {
+      uint8_t * z = static_cast<uint8_t *>(blocks[recovery[0]].buffer);
+      Mul(z, z, inverse[0], blockSize);
+    }
+    else
+    {
+      std::unique_ptr<uint8_t[]> output(new uint8_t[count * blockSize]);
+
+      for (size_t b = 0; b < count; ++b)
+      {
+        uint8_t * z = output.get() + (b * blockSize);
+
+        for (size_t a = 0; a < count; ++a)
+        {
+          const uint8_t * x = static_cast<const uint8_t *>(blocks[sources[a]].buffer);
+
+          if (a == 0)
+          {
+            Mul(z, x, inverse[b * count + a], blockSize);
+          }
+          else
+          {
+            MulAdd(z, x, inverse[b * count + a], blockSize);
+          }
+        }
+      }
+
+      for (size_t b = 0; b < count; ++b)
+      {
+        memcpy(blocks[recovery[b]].buffer, output.get() + (b * blockSize), blockSize);
+      }
+    }
+
+    for (size_t b = 0; b < count; ++b)
+    {
+      blocks[recovery[b]].index = static_cast<uint8_t>(erasures[b]);
+    }
+
+    return true;
+  }
+
+
+  const ErasureCoder * ErasureCoder::Get(const std::string & name)
+  {
+    struct Candidate
+    {
+      const ErasureCoder * coder;
+      bool supported;
+    };
+
+    static const CpuFeatures cpu = DetectCpu();
+
+    static const KernelCoder scalar("scalar", ErasureKernels::MulAddScalar, ErasureKernels::MulScalar);
+    static const Cm256Coder cm256;
+
+#if defined(__x86_64__) || defined(__i386__)
+    static const KernelCoder ssse3("ssse3", ErasureKernels::MulAddSsse3, ErasureKernels::MulSsse3);
+    static const KernelCoder avx2("avx2", ErasureKernels::MulAddAvx2, ErasureKernels::MulAvx2);
+    static const KernelCoder avx512("avx512", ErasureKernels::MulAddAvx512, ErasureKernels::MulAvx512);
+    static const KernelCoder gfniAvx2("gfni-avx2", ErasureKernels::MulAddGfniAvx2, ErasureKernels::MulGfniAvx2);
+    static const KernelCoder gfniAvx512("gfni-avx512", ErasureKernels::MulAddGfniAvx512, ErasureKernels::MulGfniAvx512);
+#endif
+
+    // Fastest first. cm256 is only used when asked for by name.
+    static const std::vector<Candidate> candidates =
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      { &gfniAvx512, cpu.gfni && cpu.avx512 },
+      { &avx512, cpu.avx512 },
+      { &gfniAvx2, cpu.gfni && cpu.avx2 },
+      { &avx2, cpu.avx2 },
+      { &ssse3, cpu.ssse3 },
+#endif
+      { &scalar, true },
+      { &cm256, true }
+    };
+
+    for (const auto & candidate : candidates)
+    {
+      if (candidate.supported && (name.empty() || name == candidate.coder->Name()))
+      {
+        return candidate.coder;
+      }
+    }
+
+    return nullptr;
+  }
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace dfs
+{
+  // Same layout as cm256_block. 'index' is the column of the block in its
+  // row, data columns first and then code columns.
+  struct ErasureBlock
+  {
+    void * buffer;
+    uint8_t index;
+  };
+
+  // Reed-Solomon coding over GF(2^8) with the Cauchy matrix of cm256, so the
+  // parity of every implementation is bit-exact with what cm256 wrote.
+  class ErasureCoder
+  {
+  public:
+
+    virtual ~ErasureCoder() = default;
+
+    virtual const char * Name() const = 0;
+
+    // z ^= c * x
+    virtual void MulAdd(uint8_t * z, const uint8_t * x, uint8_t c, size_t size) const = 0;
+
+    // z = c * x
+    virtual void Mul(uint8_t * z, const uint8_t * x, uint8_t c, size_t size) const = 0;
+
+    // z ^= x
+    void Add(uint8_t * z, const uint8_t * x, size_t size) const { MulAdd(z, x, 1, size); }
+
+    // 'data' holds the 'dataCount' data blocks in column order and 'code'
+    // receives the 'codeCount' code blocks one after the other.
+    virtual bool Encode(uint64_t dataCount, uint64_t codeCount, const ErasureBlock * data, void * code, size_t blockSize) const;
+
+    // 'blocks' holds 'dataCount' distinct blocks of the row. Code blocks are
+    // replaced in place by the missing data blocks in ascending column order
+    // and their index is updated, the same as cm256_decode.
+    virtual bool Decode(uint64_t dataCount, uint64_t codeCount, ErasureBlock * blocks, size_t blockSize) const;
+
+    // Element of the coding matrix for code block 'code' and data block 'data'.
+    static uint8_t Coefficient(uint64_t dataCount, uint64_t code, uint64_t data);
+
+    // Returns the named implementation ("scalar", "ssse3", "avx2", "avx512",
+    // "gfni-avx2", "gfni-avx512" or "cm256"), or the fastest one this CPU
+    // supports when the name is empty. Returns nullptr for an unknown name or
+    // one the CPU can't run.
+    static const ErasureCoder * Get(const std::string & name = "");
+  };
+}
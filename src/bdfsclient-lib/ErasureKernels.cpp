@@ -0,0 +1,311 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "ErasureKernels.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace dfs
+{
+  static const unsigned GF_POLYNOMIAL = 0x14D;
+
+  static GfTables BuildTables()
+  {
+    GfTables t;
+    memset(&t, 0, sizeof(t));
+
+    unsigned x = 1;
+    for (unsigned i = 0; i < 255; ++i)
+    {
+      t.exp[i] = static_cast<uint8_t>(x);
+      t.log[x] = static_cast<uint8_t>(i);
+      x <<= 1;
+      if (x & 0x100)
+      {
+        x ^= GF_POLYNOMIAL;
+      }
+    }
+
+    for (unsigned i = 255; i < 512; ++i)
+    {
+      t.exp[i] = t.exp[i - 255];
+    }
+
+    for (unsigned a = 1; a < 256; ++a)
+    {
+      for (unsigned b = 1; b < 256; ++b)
+      {
+        t.mul[a][b] = t.exp[t.log[a] + t.log[b]];
+      }
+    }
+
+    for (unsigned c = 0; c < 256; ++c)
+    {
+      for (unsigned n = 0; n < 16; ++n)
+      {
+        t.low[c][n] = t.mul[c][n];
+        t.high[c][n] = t.mul[c][n << 4];
+      }
+
+      // Row i of the matrix selects the input bits that make up bit i of the
+      // product, and gf2p8affineqb takes row i from byte 7 - i.
+      uint64_t matrix = 0;
+      for (unsigned i = 0; i < 8; ++i)
+      {
+        uint64_t row = 0;
+        for (unsigned j = 0; j < 8; ++j)
+        {
+          if ((t.mul[c][1u << j] >> i) & 1)
+          {
+            row |= (1u << j);
+          }
+        }
+        matrix |= row << (8 * (7 - i));
+      }
+      t.affine[c] = matrix;
+    }
+
+    return t;
+  }
+
+
+  const GfTables & GfTables::Get()
+  {
+    static const GfTables tables = BuildTables();
+    return tables;
+  }
+
+
+  namespace ErasureKernels
+  {
+    void MulAddScalar(uint8_t * z, const uint8_t * x, uint8_t c, size_t size)
+    {
+      if (c == 0)
+      {
+        return;
+      }
+
+      size_t i = 0;
+
+      if (c == 1)
+      {
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+          uint64_t a, b;
+          memcpy(&a, z + i, sizeof(a));
+          memcpy(&b, x + i, sizeof(b));
+          a ^= b;
+          memcpy(z + i, &a, sizeof(a));
+        }
+
+        for (; i < size; ++i)
+        {
+          z[i] ^= x[i];
+        }
+
+        return;
+      }
+
+      const uint8_t * table = GfTables::Get().mul[c];
+      for (; i < size; ++i)
+      {
+        z[i] ^= table[x[i]];
+      }
+    }
+
+
+    void MulScalar(uint8_t * z, const uint8_t * x, uint8_t c, size_t size)
+    {
+      if (c == 0)
+      {
+        memset(z, 0, size);
+        return;
+      }
+
+      if (c == 1)
+      {
+        if (z != x)
+        {
+          memmove(z, x, size);
+        }
+        return;
+      }
+
+      const uint8_t * table = GfTables::Get().mul[c];
+      for (size_t i = 0; i < size; ++i)
+      {
+        z[i] = table[x[i]];
+      }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+    // The SIMD kernels handle whole vectors and leave the tail to the scalar
+    // kernel. Each is compiled for its own instruction set only, so callers
+    // have to check the CPU first (see ErasureCoder::Get).
+
+    __attribute__((target("ssse3")))
+    static size_t Ssse3(uint8_t * z, const uint8_t * x, uint8_t c, size_t size, bool add)
+    {
+      const GfTables & t = GfTables::Get();
+      const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(t.low[c]));
+      const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(t.high[c]));
+      const __m128i mask = _mm_set1_epi8(0x0f);
+
+      size_t i = 0;
+      for (; i + 16 <= size; i += 16)
+      {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(v, mask)),
+                                  _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(v, 4), mask)));
+        if (add)
+        {
+          p = _mm_xor_si128(p, _mm_loadu_si128(reinterpret_cast<const __m128i *>(z + i)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(z + i), p);
+      }
+
+      return i;
+    }
+
+
+    __attribute__((target("avx2")))
+    static size_t Avx2(uint8_t * z, const uint8_t * x, uint8_t c, size_t size, bool add)
+    {
+      const GfTables & t = GfTables::Get();
+      const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(t.low[c])));
+      const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(t.high[c])));
+      const __m256i mask = _mm256_set1_epi8(0x0f);
+
+      size_t i = 0;
+      for (; i + 32 <= size; i += 32)
+      {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(v, mask)),
+                                     _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+        if (add)
+        {
+          p = _mm256_xor_si256(p, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(z + i)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(z + i), p);
+      }
+
+      return i;
+    }
+
+
+    __attribute__((target("avx512f,avx512bw")))
+    static size_t Avx512(uint8_t * z, const uint8_t * x, uint8_t c, size_t size, bool add)
+    {
+      const GfTables & t = GfTables::Get();
+      const __m512i low = _mm512_broadcast_i32x4(_mm_loadu_si128(reinterpret_cast<const __m128i *>(t.low[c])));
+      const __m512i high = _mm512_broadcast_i32x4(_mm_loadu_si128(reinterpret_cast<const __m128i *>(t.high[c])));
+      const __m512i mask = _mm512_set1_epi8(0x0f);
+
+      size_t i = 0;
+      for (; i + 64 <= size; i += 64)
+      {
+        __m512i v = _mm512_loadu_si512(x + i);
+        __m512i p = _mm512_xor_si512(_mm512_shuffle_epi8(low, _mm512_and_si512(v, mask)),
+                                     _mm512_shuffle_epi8(high, _mm512_and_si512(_mm512_srli_epi64(v, 4), mask)));
+        if (add)
+        {
+          p = _mm512_xor_si512(p, _mm512_loadu_si512(z + i));
+        }
+        _mm512_storeu_si512(z + i, p);
+      }
+
+      return i;
+    }
+
+
+    __attribute__((target("gfni,avx2")))
+    static size_t GfniAvx2(uint8_t * z, const uint8_t * x, uint8_t c, size_t size, bool add)
+    {
+      const __m256i matrix = _mm256_set1_epi64x(static_cast<long long>(GfTables::Get().affine[c]));
+
+      size_t i = 0;
+      for (; i + 32 <= size; i += 32)
+      {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i));
+        __m256i p = _mm256_gf2p8affine_epi64_epi8(v, matrix, 0);
+        if (add)
+        {
+          p = _mm256_xor_si256(p, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(z + i)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(z + i), p);
+      }
+
+      return i;
+    }
+
+
+    __attribute__((target("gfni,avx512f,avx512bw")))
+    static size_t GfniAvx512(uint8_t * z, const uint8_t * x, uint8_t c, size_t size, bool add)
+    {
+      const __m512i matrix = _mm512_set1_epi64(static_cast<long long>(GfTables::Get().affine[c]));
+
+      size_t i = 0;
+      for (; i + 64 <= size; i += 64)
+      {
+        __m512i v = _mm512_loadu_si512(x + i);
+        __m512i p = _mm512_gf2p8affine_epi64_epi8(v, matrix, 0);
+        if (add)
+        {
+          p = _mm512_xor_si512(p, _mm512_loadu_si512(z + i));
+        }
+        _mm512_storeu_si512(z + i, p);
+      }
+
+      return i;
+    }
+
+
+#define DEFINE_KERNELS(name) \
+    void MulAdd##name(uint8_t * z, const uint8_t * x, uint8_t c, size_t size) \
+    { \
+      if (c == 0) { return; } \
+      size_t done = name(z, x, c, size, true); \
+      MulAddScalar(z + done, x + done, c, size - done); \
+    } \
+    void Mul##name(uint8_t * z, const uint8_t * x, uint8_t c, size_t size) \
+    { \
+      if (c <= 1) { MulScalar(z, x, c, size); return; } \
+      size_t done = name(z, x, c, size, false); \
+      MulScalar(z + done, x + done, c, size - done); \
+    }
+
+    DEFINE_KERNELS(Ssse3)
+    DEFINE_KERNELS(Avx2)
+    DEFINE_KERNELS(Avx512)
+    DEFINE_KERNELS(GfniAvx2)
+    DEFINE_KERNELS(GfniAvx512)
+
+#undef DEFINE_KERNELS
+
+#endif
+  }
+}
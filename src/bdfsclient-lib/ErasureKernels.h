@@ -0,0 +1,71 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace dfs
+{
+  // Lookup tables for GF(2^8) with the polynomial used by cm256 (0x14D).
+  struct GfTables
+  {
+    uint8_t log[256];
+    uint8_t exp[512];
+    uint8_t mul[256][256];
+
+    // Products of each constant with every low and high nibble, for pshufb.
+    uint8_t low[256][16];
+    uint8_t high[256][16];
+
+    // Multiplication by each constant as a bit matrix, for gf2p8affineqb.
+    uint64_t affine[256];
+
+    static const GfTables & Get();
+  };
+
+  // Multiply-accumulate (z ^= c * x) and multiply (z = c * x) kernels. z may
+  // be equal to x for Mul.
+  namespace ErasureKernels
+  {
+    void MulAddScalar(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+    void MulScalar(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+
+#if defined(__x86_64__) || defined(__i386__)
+    void MulAddSsse3(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+    void MulSsse3(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+
+    void MulAddAvx2(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+    void MulAvx2(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+
+    void MulAddAvx512(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+    void MulAvx512(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+
+    void MulAddGfniAvx2(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+    void MulGfniAvx2(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+
+    void MulAddGfniAvx512(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+    void MulGfniAvx512(uint8_t * z, const uint8_t * x, uint8_t c, size_t size);
+#endif
+  }
+}
@@ -0,0 +1,78 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "LatencyWindow.h"
+
+#include <algorithm>
+
+namespace dfs
+{
+  LatencyWindow::LatencyWindow(size_t capacity)
+    : capacity(capacity > 0 ? capacity : 1)
+  {
+    this->samples.reserve(this->capacity);
+  }
+
+
+  void LatencyWindow::Record(uint32_t ms)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->samples.size() < this->capacity)
+    {
+      this->samples.push_back(ms);
+    }
+    else
+    {
+      this->samples[this->next] = ms;
+    }
+
+    this->next = (this->next + 1) % this->capacity;
+  }
+
+
+  bool LatencyWindow::Percentile(double percentile, uint32_t & result, size_t minSamples)
+  {
+    std::vector<uint32_t> sorted;
+
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (this->samples.size() == 0 || this->samples.size() < minSamples)
+      {
+        return false;
+      }
+
+      sorted = this->samples;
+    }
+
+    percentile = std::min(std::max(percentile, 0.0), 100.0);
+
+    size_t index = static_cast<size_t>(percentile / 100.0 * (sorted.size() - 1) + 0.5);
+
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+
+    result = sorted[index];
+
+    return true;
+  }
+}
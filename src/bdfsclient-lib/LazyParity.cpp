@@ -0,0 +1,252 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "LazyParity.h"
+#include "Volume.h"
+#include "BitSet.h"
+#include "Util.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+
+namespace dfs
+{
+  // A row is encoded this many ms after its first write, so that a burst of
+  // writes to it is merged into one encode.
+  static const uint32_t SETTLE_DELAY = 50;
+
+  // Rows that failed to encode are tried again after this many ms.
+  static const uint32_t RETRY_DELAY = 1000;
+
+
+  LazyParity::LazyParity(Volume * volume, size_t workers)
+    : volume(volume)
+    , journal(new BitSet(volume->Rows()))
+    , active(true)
+  {
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i)
+    {
+      this->threads.emplace_back(std::bind(&LazyParity::ThreadProc, this));
+    }
+  }
+
+
+  LazyParity::~LazyParity()
+  {
+    if (this->active)
+    {
+      this->active = false;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.notify_all();
+      }
+
+      for (auto & thread : this->threads)
+      {
+        if (thread.joinable())
+        {
+          thread.join();
+        }
+      }
+    }
+
+    if (this->file != nullptr)
+    {
+      fclose(this->file);
+    }
+  }
+
+
+  bool LazyParity::Open(const std::string & path)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    return_false_if(this->file != nullptr);
+
+    this->file = fopen(path.c_str(), "rb+");
+    if (this->file != nullptr)
+    {
+      this->journal->ReadFrom(this->file);
+    }
+    else
+    {
+      this->file = fopen(path.c_str(), "wb+");
+      return_false_if_msg(this->file == nullptr, "Error: failed to create parity journal '%s'.\n", path.c_str());
+
+      this->journal->WriteTo(this->file);
+      fflush(this->file);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (uint64_t row = 0; row < volume->Rows(); ++row)
+    {
+      if (this->journal->__Get(row) && this->queued.insert(row).second)
+      {
+        this->queue.emplace(now, row);
+      }
+    }
+
+    if (!this->queue.empty())
+    {
+      printf("Restoring the parity of %lu rows\n", this->queue.size());
+      this->cond.notify_all();
+    }
+
+    return true;
+  }
+
+
+  bool LazyParity::MarkDirty(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->journal->__Get(row))
+    {
+      return true;
+    }
+
+    this->journal->__Set(row, true);
+    this->journal->WriteWordTo(this->file, row);
+    return_false_if_msg(fflush(this->file) != 0 || fdatasync(fileno(this->file)) != 0, "Error: failed to save parity journal.\n");
+    return true;
+  }
+
+
+  void LazyParity::Schedule(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->queued.insert(row).second)
+    {
+      this->queue.emplace(std::chrono::steady_clock::now() + std::chrono::milliseconds(SETTLE_DELAY), row);
+      this->cond.notify_one();
+    }
+  }
+
+
+  // Not synced: a clean row left marked in the journal is only encoded
+  // once more after a crash.
+  bool LazyParity::MarkClean(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->journal->__Get(row))
+    {
+      return true;
+    }
+
+    this->journal->__Set(row, false);
+    this->journal->WriteWordTo(this->file, row);
+    return_false_if_msg(fflush(this->file) != 0, "Error: failed to save parity journal.\n");
+    return true;
+  }
+
+
+  bool LazyParity::IsDirty(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->journal->__Get(row);
+  }
+
+
+  size_t LazyParity::Pending()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->queue.size();
+  }
+
+
+  // Once stopped, the rows still queued are encoded right away and rows
+  // that fail are left to the journal.
+  void LazyParity::ThreadProc()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true)
+    {
+      if (this->queue.empty())
+      {
+        if (!this->active)
+        {
+          break;
+        }
+        this->cond.wait(lock);
+        continue;
+      }
+
+      auto next = this->queue.begin();
+      auto due = next->first;
+      if (this->active && due > std::chrono::steady_clock::now())
+      {
+        this->cond.wait_until(lock, due);
+        continue;
+      }
+
+      uint64_t row = next->second;
+      this->queue.erase(next);
+      this->queued.erase(row);
+
+      lock.unlock();
+      bool success = EncodeRow(row);
+      lock.lock();
+
+      if (!success && this->active && this->queued.insert(row).second)
+      {
+        this->queue.emplace(std::chrono::steady_clock::now() + std::chrono::milliseconds(RETRY_DELAY), row);
+      }
+    }
+  }
+
+
+  // Takes the row the same way a write does, so that no write is halfway
+  // through it while its parity is encoded.
+  bool LazyParity::EncodeRow(uint64_t row)
+  {
+    RowLocks::Guard lock(volume->rowLocks, row, row, true);
+
+    if (!IsDirty(row))
+    {
+      return true;
+    }
+
+    if (volume->IsAllocated(row))
+    {
+      Volume::RowWrite writing(volume, row);
+
+      for (uint64_t col = 0; col < volume->DataCount(); ++col)
+      {
+        if (!volume->IsRebuilt(row, col))
+        {
+          // The cell is gone and the parity can't bring it back either
+          printf("Error: row '%lx' lost column '%lx' before its parity was encoded.\n", row, col);
+          return MarkClean(row);
+        }
+      }
+
+      return_false_if_msg(!volume->FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
+      return_false_if_msg(!volume->GetRow(row).Encode(), "Error: row '%lx' could not be encoded.\n", row);
+      volume->MarkRebuilt(row);
+    }
+
+    return MarkClean(row);
+  }
+}
@@ -0,0 +1,108 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+class BitSet;
+
+namespace dfs
+{
+  class Volume;
+
+  // Defers the parity of partial row writes to the background. A writer
+  // records the row in a journal on disk before its data cells go out and
+  // is acknowledged once they are stored; 'workers' threads then encode the
+  // row from its data cells. Writes arriving while a row waits are merged
+  // into one encode. Rows left in the journal by a crash are encoded again
+  // once it is opened.
+  //
+  // Until its parity is encoded a row can't be reconstructed, so it is not
+  // hedged, scrubbed or rebuilt meanwhile.
+  class LazyParity
+  {
+  public:
+
+    LazyParity(Volume * volume, size_t workers);
+
+    // Encodes the rows still waiting before returning.
+    ~LazyParity();
+
+    // Loads the journal kept at 'path', creating it if needed, and queues
+    // the rows it lists.
+    bool Open(const std::string & path);
+
+    // Called before the first data cell of the row is written. The journal
+    // is synced before it returns.
+    bool MarkDirty(uint64_t row);
+
+    // Called once the data cells are written.
+    void Schedule(uint64_t row);
+
+    // Called when the parity of the row was encoded along with its data.
+    bool MarkClean(uint64_t row);
+
+    bool IsDirty(uint64_t row);
+
+    size_t Pending();
+
+  private:
+
+    void ThreadProc();
+
+    bool EncodeRow(uint64_t row);
+
+  private:
+
+    Volume * volume;
+
+    std::unique_ptr<BitSet> journal;
+
+    FILE * file = nullptr;
+
+    // Rows waiting to be encoded by when they are due
+    std::multimap<std::chrono::steady_clock::time_point, uint64_t> queue;
+
+    std::set<uint64_t> queued;
+
+    std::mutex mutex;
+
+    std::condition_variable cond;
+
+    std::vector<std::thread> threads;
+
+    std::atomic<bool> active;
+  };
+}
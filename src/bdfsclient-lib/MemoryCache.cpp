@@ -0,0 +1,179 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "MemoryCache.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+namespace dfs
+{
+  MemoryCache::MemoryCache(size_t blockSize, size_t budget, Demote demote, size_t shards)
+    : blockSize(blockSize)
+    , demote(std::move(demote))
+  {
+    assert(blockSize > 0);
+
+    // Fewer shards rather than shards too small to hold a block
+    size_t blocks = budget / blockSize;
+    shards = std::max<size_t>(1, std::min(shards, blocks));
+
+    this->capacity = blocks / shards;
+
+    for (size_t i = 0; i < shards; ++i)
+    {
+      this->shards.emplace_back(new Shard());
+    }
+  }
+
+
+  MemoryCache::Shard & MemoryCache::GetShard(uint64_t key)
+  {
+    // Neighbouring cells of a row land on different shards
+    return *this->shards[((key * 0x9E3779B97F4A7C15ull) >> 32) % this->shards.size()];
+  }
+
+
+  bool MemoryCache::Read(uint64_t key, void * buffer, size_t size, size_t offset)
+  {
+    assert(size + offset <= this->blockSize);
+
+    Shard & shard = this->GetShard(key);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+    {
+      ++this->misses;
+      return false;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+
+    memcpy(buffer, it->second->data.get() + offset, size);
+
+    ++this->hits;
+
+    return true;
+  }
+
+
+  bool MemoryCache::Update(uint64_t key, const void * buffer, size_t size, size_t offset)
+  {
+    assert(size + offset <= this->blockSize);
+
+    Shard & shard = this->GetShard(key);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+    {
+      return false;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+
+    memcpy(it->second->data.get() + offset, buffer, size);
+    it->second->unsaved = true;
+
+    return true;
+  }
+
+
+  bool MemoryCache::Put(uint64_t key, const void * block, bool unsaved)
+  {
+    if (this->capacity == 0)
+    {
+      return false;
+    }
+
+    Shard & shard = this->GetShard(key);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end())
+    {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+
+      memcpy(it->second->data.get(), block, this->blockSize);
+      it->second->unsaved = it->second->unsaved || unsaved;
+
+      return true;
+    }
+
+    std::unique_ptr<uint8_t[]> data;
+
+    // The block of the evicted entry is reused for the new one
+    while (shard.lru.size() >= this->capacity)
+    {
+      Entry & victim = shard.lru.back();
+
+      if (victim.unsaved && !this->demote(victim.key, victim.data.get()))
+      {
+        // Kept rather than lost, at the cost of going over budget for now
+        shard.lru.splice(shard.lru.begin(), shard.lru, std::prev(shard.lru.end()));
+        break;
+      }
+
+      data = std::move(victim.data);
+      shard.index.erase(victim.key);
+      shard.lru.pop_back();
+      this->bytes -= this->blockSize;
+    }
+
+    if (!data)
+    {
+      data.reset(new (std::nothrow) uint8_t[this->blockSize]);
+      if (!data)
+      {
+        return false;
+      }
+    }
+
+    memcpy(data.get(), block, this->blockSize);
+
+    shard.lru.push_front({key, std::move(data), unsaved});
+    shard.index[key] = shard.lru.begin();
+    this->bytes += this->blockSize;
+
+    return true;
+  }
+
+
+  void MemoryCache::Erase(uint64_t key)
+  {
+    Shard & shard = this->GetShard(key);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+    {
+      return;
+    }
+
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+    this->bytes -= this->blockSize;
+  }
+}
@@ -0,0 +1,108 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace dfs
+{
+  // Keeps recently used blocks in memory, up to a byte budget split over
+  // independently locked shards, each evicting its least recently used
+  // block. Blocks put as unsaved are handed to the demote callback when they
+  // are evicted, so that they can be written to the next tier down.
+  class MemoryCache
+  {
+  public:
+
+    // Called under the shard lock. Returning false keeps the block cached.
+    using Demote = std::function<bool(uint64_t key, const uint8_t * block)>;
+
+    MemoryCache(size_t blockSize, size_t budget, Demote demote, size_t shards = 16);
+
+    MemoryCache(const MemoryCache &) = delete;
+
+    MemoryCache & operator=(const MemoryCache &) = delete;
+
+    // Copies 'size' bytes at 'offset' of the block out, false on a miss.
+    bool Read(uint64_t key, void * buffer, size_t size, size_t offset);
+
+    // Writes into a cached block and marks it unsaved, false on a miss.
+    bool Update(uint64_t key, const void * buffer, size_t size, size_t offset);
+
+    // Caches a whole block, evicting others to make room. False if the
+    // budget can't hold a single block.
+    bool Put(uint64_t key, const void * block, bool unsaved);
+
+    // Drops the block without demoting it.
+    void Erase(uint64_t key);
+
+    size_t Bytes() const { return bytes; }
+
+    uint64_t Hits() const { return hits; }
+
+    uint64_t Misses() const { return misses; }
+
+  private:
+
+    struct Entry
+    {
+      uint64_t key;
+      std::unique_ptr<uint8_t[]> data;
+      bool unsaved;
+    };
+
+    struct Shard
+    {
+      std::mutex mutex;
+      std::list<Entry> lru;
+      std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    };
+
+    Shard & GetShard(uint64_t key);
+
+  private:
+
+    size_t blockSize;
+
+    // Blocks each shard holds at most
+    size_t capacity;
+
+    Demote demote;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::atomic<size_t> bytes{0};
+
+    std::atomic<uint64_t> hits{0};
+
+    std::atomic<uint64_t> misses{0};
+  };
+}
@@ -20,15 +20,44 @@
   SOFTWARE.
 */
 
+#include <stdio.h>
 #include <string.h>
+#include <atomic>
+#include <chrono>
 #include "Partition.h"
 
 namespace dfs
 {
+  // Feeds the request behind 'result' to the scoreboard, which learns how it
+  // went once the request completes.
+  template<typename T, typename F>
+  static bdfs::AsyncResultPtr<T> Track(const std::shared_ptr<PartitionHealth> & health, const bdfs::AsyncResultPtr<T> & result, F succeeded)
+  {
+    health->Begin();
+
+    if (!result)
+    {
+      health->End(0, false);
+      return result;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto request = result.get();
+    result->OnComplete([health, start, request, succeeded]()
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      health->End(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), succeeded(request->GetResult()));
+    });
+
+    return result;
+  }
+
   Partition::Partition(std::shared_ptr<bdfs::BdPartition> obj, uint64_t blockCount, size_t blockSize)
     : blockCount(blockCount)
     , blockSize(blockSize)
     , ref(obj)
+    , health(std::make_shared<PartitionHealth>())
+    , trims(std::make_shared<std::atomic<bool>>(true))
   {
   }
 
@@ -47,8 +76,25 @@ namespace dfs
 
   bool Partition::ReadBlock(uint64_t index, void * buffer, size_t size, size_t offset)
   {
-    auto result = ref->Read(index, offset, size);
-    if (result->Wait(ref->GetTimeout()))
+    return EndReadBlock(BeginReadBlock(index, size, offset), buffer, size);
+  }
+
+
+  bool Partition::WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset, size_t used)
+  {
+    return EndWriteBlock(BeginWriteBlock(index, buffer, size, offset, used), size);
+  }
+
+
+  bdfs::AsyncResultPtr<std::string> Partition::BeginReadBlock(uint64_t index, size_t size, size_t offset)
+  {
+    return Track(health, ref->Read(index, offset, size), [size](const std::string & data) { return data.size() == size; });
+  }
+
+
+  bool Partition::EndReadBlock(const bdfs::AsyncResultPtr<std::string> & result, void * buffer, size_t size)
+  {
+    if (result && result->Wait(ref->GetTimeout()))
     {
       auto & buf = result->GetResult();
       if (buf.size() == size)
@@ -62,10 +108,99 @@ namespace dfs
   }
 
 
-  bool Partition::WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset)
+  // A whole block whose caller says only its first 'used' bytes hold data,
+  // such as a compressed cell, uploads just those and trims the rest. Should
+  // the host reject the trim, the zeros are written after all and later
+  // blocks go out whole. The result completes once everything is done.
+  bdfs::AsyncResultPtr<ssize_t> Partition::BeginWriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset, size_t used)
   {
-    auto result = ref->Write(index, offset, buffer, size);
-    if (result->Wait(ref->GetTimeout()))
+    if (offset != 0 || used >= size || !*trims)
+    {
+      return TrackWrite(ref->Write(index, offset, buffer, size), size);
+    }
+
+    auto trim = ref->Trim(index, used, size - used);
+    auto write = used > 0 ? TrackWrite(ref->Write(index, 0, buffer, used), used) : nullptr;
+    if (!trim || (used > 0 && !write))
+    {
+      return nullptr;
+    }
+
+    // The requests are kept alive by the result, which they only reference
+    // weakly so that neither outlives the caller's interest.
+    auto result = std::make_shared<bdfs::AsyncResult<ssize_t>>([trim, write](bdfs::AsyncResult<ssize_t> *) {});
+    std::weak_ptr<bdfs::AsyncResult<ssize_t>> weak = result;
+
+    auto pending = std::make_shared<std::atomic<int>>(write ? 2 : 1);
+    auto failed = std::make_shared<std::atomic<bool>>(false);
+    auto done = [weak, pending, failed, size](bool success) {
+      if (!success)
+      {
+        *failed = true;
+      }
+      auto result = weak.lock();
+      if (--*pending == 0 && result)
+      {
+        result->Complete(*failed ? static_cast<ssize_t>(-1) : static_cast<ssize_t>(size));
+      }
+    };
+
+    auto trimming = trim.get();
+    auto ref = this->ref;
+    auto health = this->health;
+    auto trims = this->trims;
+    trim->OnComplete([trimming, done, ref, health, trims, index, used, size]() {
+      if (trimming->GetResult())
+      {
+        done(true);
+        return;
+      }
+
+      std::string zeros(size - used, '\0');
+      auto zero = Track(health, ref->Write(index, used, zeros.data(), zeros.size()), [size, used](ssize_t written) { return written == static_cast<ssize_t>(size - used); });
+      if (!zero)
+      {
+        done(false);
+        return;
+      }
+
+      // A host that takes the zeros but not the trim is up and just can't trim
+      auto zeroing = zero.get();
+      zero->OnComplete([zero, zeroing, done, ref, trims, size, used]() {
+        bool written = zeroing->GetResult() == static_cast<ssize_t>(size - used);
+        if (written && trims->exchange(false))
+        {
+          printf("Warning: partition '%s' on '%s' does not trim, writing whole blocks.\n", ref->Name().c_str(), ref->Host().c_str());
+        }
+        done(written);
+      });
+    });
+
+    if (write)
+    {
+      auto writing = write.get();
+      write->OnComplete([writing, done, used]() { done(writing->GetResult() == static_cast<ssize_t>(used)); });
+    }
+
+    return result;
+  }
+
+
+  bdfs::AsyncResultPtr<ssize_t> Partition::TrackWrite(const bdfs::AsyncResultPtr<ssize_t> & result, size_t size)
+  {
+    return Track(health, result, [size](ssize_t written) { return written == static_cast<ssize_t>(size); });
+  }
+
+
+  bdfs::AsyncResultPtr<bool> Partition::TrackTrim(const bdfs::AsyncResultPtr<bool> & result)
+  {
+    return Track(health, result, [](bool trimmed) { return trimmed; });
+  }
+
+
+  bool Partition::EndWriteBlock(const bdfs::AsyncResultPtr<ssize_t> & result, size_t size)
+  {
+    if (result && result->Wait(ref->GetTimeout()))
     {
       return result->GetResult() == static_cast<ssize_t>(size);
     }
@@ -74,6 +209,23 @@ namespace dfs
   }
 
 
+  bdfs::AsyncResultPtr<bool> Partition::BeginTrimBlock(uint64_t index, size_t size, size_t offset)
+  {
+    return TrackTrim(ref->Trim(index, offset, size));
+  }
+
+
+  bool Partition::EndTrimBlock(const bdfs::AsyncResultPtr<bool> & result)
+  {
+    if (result && result->Wait(ref->GetTimeout()))
+    {
+      return result->GetResult();
+    }
+
+    return false;
+  }
+
+
   bool Partition::Delete()
   {
     auto result = ref->Delete();
@@ -22,7 +22,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include "BdPartition.h"
+#include "PartitionHealth.h"
 
 namespace dfs
 {
@@ -38,18 +41,44 @@ namespace dfs
     bool VerifyBlock(uint64_t index);
     bool InitBlock(uint64_t index);
     bool ReadBlock(uint64_t index, void * buffer, size_t size, size_t offset);
-    bool WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset);
+    bool WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset, size_t used = SIZE_MAX);
+
+    // Split versions of ReadBlock/WriteBlock so that requests to several
+    // partitions can be put on the wire before waiting for any of them.
+    bdfs::AsyncResultPtr<std::string> BeginReadBlock(uint64_t index, size_t size, size_t offset);
+    bool EndReadBlock(const bdfs::AsyncResultPtr<std::string> & result, void * buffer, size_t size);
+    bdfs::AsyncResultPtr<ssize_t> BeginWriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset, size_t used = SIZE_MAX);
+    bool EndWriteBlock(const bdfs::AsyncResultPtr<ssize_t> & result, size_t size);
+
+    // Releases the space of a block on the host, which reads back as zeros.
+    bdfs::AsyncResultPtr<bool> BeginTrimBlock(uint64_t index, size_t size, size_t offset);
+    bool EndTrimBlock(const bdfs::AsyncResultPtr<bool> & result);
 
     bool Delete();
 
     uint32_t GetTimeout() const;
 
+    // Partitions on the same host share its bandwidth.
+    const std::string & Host() const { return ref->Host(); }
+
+    // Latency and errors of every block request sent so far.
+    const PartitionHealth & Health() const { return *health; }
+
   private:
 
+    bdfs::AsyncResultPtr<ssize_t> TrackWrite(const bdfs::AsyncResultPtr<ssize_t> & result, size_t size);
+    bdfs::AsyncResultPtr<bool> TrackTrim(const bdfs::AsyncResultPtr<bool> & result);
+
     uint64_t blockCount;
 
     size_t blockSize;
 
     std::shared_ptr<bdfs::BdPartition> ref;
+
+    // Shared with the completion callbacks of requests still on the wire
+    std::shared_ptr<PartitionHealth> health;
+
+    // Cleared once the host rejects a trim, older hosts don't have TrimBlock
+    std::shared_ptr<std::atomic<bool>> trims;
   };
 }
@@ -0,0 +1,82 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "PartitionHealth.h"
+
+#include <algorithm>
+
+namespace dfs
+{
+  // Weight of the newest sample in the moving averages, the same as the
+  // smoothed round trip time of TCP.
+  static const double ALPHA = 1.0 / 8;
+
+  // Error rate at which a partition is considered as good as unusable.
+  static const double MAX_ERROR_RATE = 0.95;
+
+  void PartitionHealth::Begin()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->score.inFlight++;
+  }
+
+
+  void PartitionHealth::End(uint32_t ms, bool success)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->score.requests == 0)
+    {
+      this->score.latency = ms;
+    }
+    else
+    {
+      this->score.latency += ALPHA * (ms - this->score.latency);
+    }
+
+    this->score.errorRate += ALPHA * ((success ? 0.0 : 1.0) - this->score.errorRate);
+    this->score.inFlight--;
+    this->score.requests++;
+    this->score.errors += success ? 0 : 1;
+  }
+
+
+  PartitionHealth::Score PartitionHealth::GetScore() const
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    return this->score;
+  }
+
+
+  // Every request already queued on the host is assumed to go first, and
+  // failures to be retried until one succeeds.
+  double PartitionHealth::Cost() const
+  {
+    Score score = GetScore();
+
+    double tries = 1.0 / (1.0 - std::min(score.errorRate, MAX_ERROR_RATE));
+
+    return (score.latency + 1) * (score.inFlight + 1) * tries;
+  }
+}
@@ -0,0 +1,64 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+namespace dfs
+{
+  // Scoreboard of how the host behind a partition is doing, fed by every
+  // request sent to it: smoothed latency, smoothed error rate and the number
+  // of requests still outstanding. A host that stops answering shows up as
+  // a growing in-flight count.
+  class PartitionHealth
+  {
+  public:
+
+    struct Score
+    {
+      double latency;
+      double errorRate;
+      uint32_t inFlight;
+      uint64_t requests;
+      uint64_t errors;
+    };
+
+    void Begin();
+
+    void End(uint32_t ms, bool success);
+
+    Score GetScore() const;
+
+    // Rough estimate in ms of how long the next request will take, used to
+    // rank partitions against each other.
+    double Cost() const;
+
+  private:
+
+    mutable std::mutex mutex;
+
+    Score score = {};
+  };
+}
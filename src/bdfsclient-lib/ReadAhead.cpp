@@ -0,0 +1,191 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "ReadAhead.h"
+#include "Volume.h"
+#include "Cache.h"
+
+#include <algorithm>
+
+namespace dfs
+{
+  ReadAhead::ReadAhead(Volume * volume, uint64_t windowRows, size_t workers)
+    : volume(volume)
+    , windowRows(windowRows)
+    , active(true)
+  {
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i)
+    {
+      this->threads.emplace_back(std::bind(&ReadAhead::ThreadProc, this));
+    }
+  }
+
+
+  ReadAhead::~ReadAhead()
+  {
+    if (this->active)
+    {
+      this->active = false;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.notify_all();
+      }
+
+      for (auto & thread : this->threads)
+      {
+        if (thread.joinable())
+        {
+          thread.join();
+        }
+      }
+    }
+  }
+
+
+  void ReadAhead::Observe(size_t offset, size_t size)
+  {
+    size_t rowSize = volume->DataCount() * volume->BlockSize();
+    uint64_t first = offset / rowSize;
+    uint64_t last = (offset + size - 1) / rowSize;
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    for (uint64_t row = first; row <= last; ++row)
+    {
+      if (this->fetched.erase(row) > 0)
+      {
+        ++this->hits;
+      }
+    }
+
+    // Requests that the kernel issues in parallel may arrive slightly out of
+    // order, so anything within a row of where the last one ended counts.
+    bool sequential = this->nextOffset > 0 &&
+                      offset + rowSize >= this->nextOffset &&
+                      offset <= this->nextOffset + rowSize;
+
+    if (sequential)
+    {
+      this->window = std::min(std::max<uint64_t>(this->window * 2, 1), this->windowRows);
+      this->nextOffset = std::max(this->nextOffset, offset + size);
+    }
+    else
+    {
+      this->window = 0;
+      this->nextOffset = offset + size;
+      this->queuedEnd = 0;
+      this->queue.clear();
+      this->fetched.clear();
+      return;
+    }
+
+    this->fetched.erase(this->fetched.begin(), this->fetched.lower_bound(first));
+
+    // Rows that are being read by now are not worth fetching anymore
+    while (!this->queue.empty() && this->queue.front() <= last)
+    {
+      this->queue.pop_front();
+    }
+
+    uint64_t begin = std::max(this->queuedEnd, last + 1);
+    uint64_t end = std::min(last + 1 + this->window, volume->Rows());
+
+    for (uint64_t row = begin; row < end; ++row)
+    {
+      this->queue.push_back(row);
+    }
+
+    if (begin < end)
+    {
+      this->queuedEnd = end;
+      this->cond.notify_all();
+    }
+  }
+
+
+  ReadAhead::Progress ReadAhead::GetProgress()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return { this->window, this->prefetched, this->hits };
+  }
+
+
+  void ReadAhead::ThreadProc()
+  {
+    while (this->active)
+    {
+      uint64_t row = 0;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.wait(lock, [this]() { return !this->active || !this->queue.empty(); });
+        if (!this->active)
+        {
+          break;
+        }
+
+        row = this->queue.front();
+        this->queue.pop_front();
+      }
+
+      if (Prefetch(row))
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        ++this->prefetched;
+        if (row < this->queuedEnd)
+        {
+          this->fetched.insert(row);
+        }
+      }
+    }
+  }
+
+
+  // The cells are read from the partitions here rather than through the
+  // cache, whose thread would otherwise be held up by the round trip.
+  bool ReadAhead::Prefetch(uint64_t row)
+  {
+    Cache * cache = volume->cache.get();
+    if (cache == nullptr || !volume->IsAllocated(row) || !volume->IsRebuilt(row))
+    {
+      return false;
+    }
+
+    size_t blockSize = volume->BlockSize();
+    uint64_t dataCount = volume->DataCount();
+
+    uint64_t epoch = cache->Evictions();
+
+    BufferPool::Buffer buffer = volume->RowPool().Acquire(dataCount * blockSize);
+    std::vector<CellIo> cells;
+
+    for (uint64_t col = 0; col < dataCount; ++col)
+    {
+      cells.push_back({col, buffer.get() + (col * blockSize), blockSize, 0, false});
+    }
+
+    volume->__ReadDirect(row, cells);
+
+    return cache->Fill(row, cells, epoch);
+  }
+}
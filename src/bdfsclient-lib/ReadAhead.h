@@ -0,0 +1,100 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace dfs
+{
+  class Volume;
+
+  // Watches the offsets of foreground reads and, once they run sequentially,
+  // has 'workers' threads fetch the rows ahead of them into the cache of the
+  // volume. The window starts at one row and doubles with every sequential
+  // read up to 'windowRows'; a read elsewhere resets it.
+  class ReadAhead
+  {
+  public:
+
+    struct Progress
+    {
+      uint64_t window;
+      uint64_t prefetched;
+      uint64_t hits;
+    };
+
+    ReadAhead(Volume * volume, uint64_t windowRows, size_t workers);
+
+    ~ReadAhead();
+
+    // Called with every foreground read before it is served.
+    void Observe(size_t offset, size_t size);
+
+    Progress GetProgress();
+
+  private:
+
+    void ThreadProc();
+
+    bool Prefetch(uint64_t row);
+
+  private:
+
+    Volume * volume;
+
+    uint64_t windowRows;
+
+    // Where a sequential read would continue
+    size_t nextOffset = 0;
+
+    uint64_t window = 0;
+
+    // Rows below this were already queued
+    uint64_t queuedEnd = 0;
+
+    std::deque<uint64_t> queue;
+
+    // Prefetched rows that have not been read yet
+    std::set<uint64_t> fetched;
+
+    uint64_t prefetched = 0;
+
+    uint64_t hits = 0;
+
+    std::mutex mutex;
+
+    std::condition_variable cond;
+
+    std::vector<std::thread> threads;
+
+    std::atomic<bool> active;
+  };
+}
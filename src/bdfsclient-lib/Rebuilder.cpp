@@ -0,0 +1,510 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "Rebuilder.h"
+#include "Volume.h"
+#include "BitSet.h"
+#include "Util.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <memory.h>
+#include <algorithm>
+
+namespace dfs
+{
+  // Batches between two checkpoints.
+  static const uint64_t CHECKPOINT_INTERVAL = 16;
+
+  // Pause before a new pass over the rows that were skipped or failed.
+  static const uint32_t PASS_DELAY = 5000;
+
+
+  Rebuilder::Rebuilder(Volume * volume, uint64_t column, std::string checkpointPath, bool resume, size_t workers, size_t batch, uint32_t rowsPerSecond)
+    : volume(volume)
+    , column(column)
+    , checkpointPath(std::move(checkpointPath))
+    , batch(std::max<size_t>(batch, 1))
+    , rowsPerSecond(rowsPerSecond)
+    , method(XOR)
+    , rebuilt(new BitSet(volume->Rows()))
+    , remaining(volume->Rows())
+    , nextSlot(std::chrono::steady_clock::now())
+    , next(0)
+    , batches(0)
+    , active(true)
+    , done(false)
+  {
+    uint64_t dataCount = volume->DataCount();
+    uint64_t codeCount = volume->CodeCount();
+
+    ++volume->rebuildActive;
+
+    if (column < dataCount && volume->LocalCount() > 0)
+    {
+      uint64_t group = volume->LocalGroupOf(column);
+      for (uint64_t i = volume->LocalGroupBegin(group); i < volume->LocalGroupBegin(group + 1); ++i)
+      {
+        if (i != column)
+        {
+          sources.push_back(i);
+        }
+      }
+      sources.push_back(volume->LocalColumn(group));
+    }
+    else if (column < dataCount)
+    {
+      // Any data column can be restored from the others and the first
+      // global parity column.
+      method = DECODE;
+      for (uint64_t i = 0; i < dataCount; ++i)
+      {
+        if (i != column)
+        {
+          sources.push_back(i);
+        }
+      }
+      sources.push_back(dataCount);
+    }
+    else if (column < dataCount + codeCount)
+    {
+      method = ENCODE;
+      for (uint64_t i = 0; i < dataCount; ++i)
+      {
+        sources.push_back(i);
+      }
+    }
+    else
+    {
+      uint64_t group = column - volume->LocalColumn(0);
+      for (uint64_t i = volume->LocalGroupBegin(group); i < volume->LocalGroupBegin(group + 1); ++i)
+      {
+        sources.push_back(i);
+      }
+    }
+
+    if (!resume || !Load())
+    {
+      Save();
+    }
+
+    if (remaining == 0)
+    {
+      Finish();
+      return;
+    }
+
+    printf("Rebuilding column %ld, %ld rows left.\n", column, remaining);
+
+    if (method == DECODE && codeCount == 0)
+    {
+      printf("Error: column %ld has no parity to be rebuilt from.\n", column);
+      return;
+    }
+
+    for (size_t i = 0; i < workers; ++i)
+    {
+      threads.emplace_back(std::bind(&Rebuilder::ThreadProc, this));
+    }
+  }
+
+
+  Rebuilder::~Rebuilder()
+  {
+    Stop();
+
+    if (!done)
+    {
+      Save();
+      --volume->rebuildActive;
+    }
+  }
+
+
+  void Rebuilder::Stop()
+  {
+    if (this->active)
+    {
+      this->active = false;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.notify_all();
+      }
+
+      for (auto & thread : this->threads)
+      {
+        if (thread.joinable())
+        {
+          thread.join();
+        }
+      }
+    }
+  }
+
+
+  void Rebuilder::Discard()
+  {
+    Stop();
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!checkpointPath.empty())
+    {
+      unlink(checkpointPath.c_str());
+      checkpointPath.clear();
+    }
+  }
+
+
+  bool Rebuilder::IsRebuilt(uint64_t row)
+  {
+    if (done)
+    {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return rebuilt->__Get(row);
+  }
+
+
+  void Rebuilder::MarkRebuilt(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (done || row >= volume->Rows() || rebuilt->__Get(row))
+    {
+      return;
+    }
+
+    rebuilt->__Set(row, true);
+
+    if (--remaining == 0)
+    {
+      Finish();
+    }
+  }
+
+
+  uint64_t Rebuilder::Remaining()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return remaining;
+  }
+
+
+  void Rebuilder::Finish()
+  {
+    if (!checkpointPath.empty())
+    {
+      unlink(checkpointPath.c_str());
+    }
+
+    printf("Rebuilt column %ld.\n", column);
+
+    done = true;
+    --volume->rebuildActive;
+    cond.notify_all();
+  }
+
+
+  void Rebuilder::ThreadProc()
+  {
+    uint64_t rows = volume->Rows();
+
+    while (this->active && !this->done)
+    {
+      uint64_t first = this->next.fetch_add(batch);
+
+      if (first >= rows)
+      {
+        // The pass is over. Rows that were being written or could not be
+        // rebuilt are picked up by the next one.
+        if (!WaitFor(std::chrono::milliseconds(PASS_DELAY)))
+        {
+          break;
+        }
+
+        uint64_t expected = this->next;
+        if (expected >= rows)
+        {
+          this->next.compare_exchange_strong(expected, 0);
+        }
+        continue;
+      }
+
+      Throttle(RebuildRows(first, std::min<uint64_t>(batch, rows - first)));
+
+      if (++this->batches % CHECKPOINT_INTERVAL == 0)
+      {
+        Save();
+      }
+    }
+  }
+
+
+  // Spaces the batches of all workers so that no more than 'rowsPerSecond'
+  // rows are rebuilt per second, leaving the partitions to foreground I/O.
+  void Rebuilder::Throttle(uint64_t rows)
+  {
+    if (rowsPerSecond == 0 || rows == 0)
+    {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    auto now = std::chrono::steady_clock::now();
+    if (nextSlot < now)
+    {
+      nextSlot = now;
+    }
+
+    nextSlot += std::chrono::microseconds(rows * 1000000 / rowsPerSecond);
+
+    auto until = nextSlot;
+    this->cond.wait_until(lock, until, [this]() { return !this->active || this->done; });
+  }
+
+
+  bool Rebuilder::WaitFor(std::chrono::milliseconds timeout)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cond.wait_for(lock, timeout, [this]() { return !this->active || this->done; });
+    return this->active && !this->done;
+  }
+
+
+  uint64_t Rebuilder::RebuildRows(uint64_t first, uint64_t count)
+  {
+    size_t blockSize = volume->BlockSize();
+    Partition * target = volume->partitions[column];
+
+    struct Job
+    {
+      uint64_t row;
+      std::vector<bdfs::AsyncResultPtr<std::string>> reads;
+      BufferPool::Buffer cell;
+      bdfs::AsyncResultPtr<ssize_t> write;
+    };
+
+    std::vector<Job> jobs;
+    jobs.reserve(count);
+
+    // Rows are claimed so that no write reaches them until the rebuilt cell
+    // is stored, and rows that are being written are left for a later pass.
+    for (uint64_t row = first; row < first + count; ++row)
+    {
+      if (IsRebuilt(row) || !volume->ClaimRow(row))
+      {
+        continue;
+      }
+
+      if (!volume->IsAllocated(row))
+      {
+        // The row reads as zeros whatever the new cell holds
+        MarkRebuilt(row);
+        volume->ReleaseRow(row);
+        continue;
+      }
+
+      jobs.emplace_back();
+      Job & job = jobs.back();
+      job.row = row;
+
+      for (auto source : sources)
+      {
+        job.reads.emplace_back(volume->partitions[source]->BeginReadBlock(row, blockSize, 0));
+      }
+    }
+
+    // The source cells of one row at a time go to a pooled row buffer; only
+    // the rebuilt cell is kept until its write completes.
+    BufferPool::Buffer sourceBuffer = volume->RowPool().Acquire(sources.size() * blockSize);
+    std::vector<uint8_t *> buffers;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+      buffers.push_back(sourceBuffer.get() + (i * blockSize));
+    }
+
+    for (auto & job : jobs)
+    {
+      bool success = true;
+
+      for (size_t i = 0; i < sources.size(); ++i)
+      {
+        success = volume->partitions[sources[i]]->EndReadBlock(job.reads[i], buffers[i], blockSize) && success;
+      }
+
+      job.cell = volume->BlockPool().Acquire();
+
+      if (success && Reconstruct(buffers, job.cell.get()))
+      {
+        job.write = target->BeginWriteBlock(job.row, job.cell.get(), blockSize, 0, volume->StoredSize(job.cell.get(), blockSize, 0));
+      }
+    }
+
+    for (auto & job : jobs)
+    {
+      if (job.write && target->EndWriteBlock(job.write, blockSize))
+      {
+        MarkRebuilt(job.row);
+      }
+      else
+      {
+        printf("Error: failed to rebuild [%lx,%lx].\n", job.row, column);
+      }
+
+      volume->ReleaseRow(job.row);
+    }
+
+    return jobs.size();
+  }
+
+
+  bool Rebuilder::Reconstruct(const std::vector<uint8_t *> & buffers, uint8_t * out)
+  {
+    const ErasureCoder * coder = volume->coder;
+    size_t blockSize = volume->BlockSize();
+    uint64_t dataCount = volume->DataCount();
+
+    switch (method)
+    {
+    case XOR:
+      memcpy(out, buffers[0], blockSize);
+      for (size_t i = 1; i < buffers.size(); ++i)
+      {
+        coder->Add(out, buffers[i], blockSize);
+      }
+      break;
+
+    case DECODE:
+    {
+      ErasureBlock blocks[256] = {};
+      for (uint64_t i = 0, j = 0; i < dataCount; ++i)
+      {
+        if (i == column)
+        {
+          blocks[i].buffer = buffers.back();
+          blocks[i].index = dataCount;
+        }
+        else
+        {
+          blocks[i].buffer = buffers[j++];
+          blocks[i].index = i;
+        }
+      }
+
+      return_false_if(!coder->Decode(dataCount, volume->CodeCount(), blocks, blockSize));
+      memcpy(out, blocks[column].buffer, blockSize);
+      break;
+    }
+
+    case ENCODE:
+      // Only the one parity cell is needed, not the whole code of the row.
+      for (uint64_t i = 0; i < dataCount; ++i)
+      {
+        uint8_t c = ErasureCoder::Coefficient(dataCount, column - dataCount, i);
+        if (i == 0)
+        {
+          coder->Mul(out, buffers[i], c, blockSize);
+        }
+        else
+        {
+          coder->MulAdd(out, buffers[i], c, blockSize);
+        }
+      }
+      break;
+    }
+
+    return true;
+  }
+
+
+  bool Rebuilder::Load()
+  {
+    if (checkpointPath.empty())
+    {
+      return false;
+    }
+
+    FILE * file = fopen(checkpointPath.c_str(), "rb");
+    return_false_if(file == NULL);
+
+    uint64_t rows = volume->Rows();
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size != static_cast<long>((rows + 7) / 8))
+    {
+      printf("Warning: ignoring checkpoint '%s' of the wrong size.\n", checkpointPath.c_str());
+      fclose(file);
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    rebuilt->ReadFrom(file);
+    fclose(file);
+
+    remaining = 0;
+    for (uint64_t row = 0; row < rows; ++row)
+    {
+      if (!rebuilt->__Get(row))
+      {
+        ++remaining;
+      }
+    }
+
+    return true;
+  }
+
+
+  // The bitmap goes to a temporary file first so that a crash never leaves
+  // a torn checkpoint behind.
+  bool Rebuilder::Save()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (checkpointPath.empty() || done)
+    {
+      return true;
+    }
+
+    std::string temp = checkpointPath + ".tmp";
+
+    FILE * file = fopen(temp.c_str(), "wb");
+    return_false_if_msg(file == NULL, "Error: failed to open checkpoint '%s'.\n", temp.c_str());
+
+    rebuilt->WriteTo(file);
+
+    bool success = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    success = fclose(file) == 0 && success;
+    success = success && rename(temp.c_str(), checkpointPath.c_str()) == 0;
+
+    return_false_if_msg(!success, "Error: failed to save checkpoint '%s'.\n", checkpointPath.c_str());
+
+    return true;
+  }
+}
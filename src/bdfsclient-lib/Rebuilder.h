@@ -0,0 +1,140 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+
+class BitSet;
+
+namespace dfs
+{
+  class Volume;
+
+  // Restores every row of a column whose partition was replaced, in the
+  // background. Workers take batches of rows, read the cells each row needs
+  // from the surviving columns with all requests of the batch in flight at
+  // once, rebuild the lost cells and write them to the new partition.
+  //
+  // Rows that are done are recorded in a bitmap which is saved to
+  // 'checkpointPath' every few batches, so a restarted client continues
+  // where it stopped. Until a row is done the volume treats its cell in this
+  // column as lost and repairs the row itself when it is accessed.
+  class Rebuilder
+  {
+  public:
+
+    // 'resume' continues from the checkpoint, otherwise every row is lost.
+    // 'rowsPerSecond' caps the rate shared by all workers, 0 for no limit.
+    // 'workers' 0 only tracks the rows, which are then repaired on access.
+    Rebuilder(Volume * volume, uint64_t column, std::string checkpointPath, bool resume, size_t workers, size_t batch, uint32_t rowsPerSecond);
+
+    ~Rebuilder();
+
+    // Stops the workers and deletes the checkpoint, for a rebuilder that is
+    // superseded because the column was replaced again.
+    void Discard();
+
+    uint64_t Column() const { return column; }
+
+    bool IsDone() const { return done; }
+
+    bool IsRebuilt(uint64_t row);
+
+    void MarkRebuilt(uint64_t row);
+
+    uint64_t Remaining();
+
+  private:
+
+    enum Method
+    {
+      XOR,
+      DECODE,
+      ENCODE
+    };
+
+    void ThreadProc();
+
+    void Stop();
+
+    void Throttle(uint64_t rows);
+
+    bool WaitFor(std::chrono::milliseconds timeout);
+
+    // Returns the number of rows it attempted.
+    uint64_t RebuildRows(uint64_t first, uint64_t count);
+
+    bool Reconstruct(const std::vector<uint8_t *> & buffers, uint8_t * out);
+
+    bool Load();
+
+    bool Save();
+
+    void Finish();
+
+  private:
+
+    Volume * volume;
+
+    uint64_t column;
+
+    std::string checkpointPath;
+
+    size_t batch;
+
+    uint32_t rowsPerSecond;
+
+    Method method;
+
+    std::vector<uint64_t> sources;
+
+    std::unique_ptr<BitSet> rebuilt;
+
+    uint64_t remaining;
+
+    std::mutex mutex;
+
+    std::condition_variable cond;
+
+    std::chrono::steady_clock::time_point nextSlot;
+
+    std::atomic<uint64_t> next;
+
+    std::atomic<uint64_t> batches;
+
+    std::atomic<bool> active;
+
+    std::atomic<bool> done;
+
+    std::vector<std::thread> threads;
+  };
+}
@@ -0,0 +1,60 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "RowLocks.h"
+
+namespace dfs
+{
+  RowLocks::Guard::Guard(RowLocks & locks, uint64_t first, uint64_t last, bool exclusive)
+    : locks(locks)
+  {
+    std::unique_lock<std::mutex> lock(locks.mutex);
+
+    range = locks.ranges.insert(locks.ranges.end(), {first, last, exclusive});
+
+    locks.cond.wait(lock, [this]() { return this->locks.Granted(range); });
+  }
+
+
+  RowLocks::Guard::~Guard()
+  {
+    std::unique_lock<std::mutex> lock(locks.mutex);
+
+    locks.ranges.erase(range);
+
+    locks.cond.notify_all();
+  }
+
+
+  bool RowLocks::Granted(std::list<Range>::iterator range) const
+  {
+    for (auto it = ranges.begin(); it != range; ++it)
+    {
+      if (it->first <= range->last && range->first <= it->last && (it->exclusive || range->exclusive))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,81 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+
+namespace dfs
+{
+  // Reader/writer locks over ranges of rows. A request locks every row it
+  // touches in one go, so it never holds part of its range while waiting
+  // for the rest. Conflicting requests are granted in arrival order, which
+  // keeps a stream of readers from starving a writer.
+  class RowLocks
+  {
+  private:
+
+    struct Range
+    {
+      uint64_t first;
+      uint64_t last;
+      bool exclusive;
+    };
+
+  public:
+
+    class Guard
+    {
+    public:
+
+      Guard(RowLocks & locks, uint64_t first, uint64_t last, bool exclusive);
+
+      ~Guard();
+
+      Guard(const Guard &) = delete;
+
+      Guard & operator=(const Guard &) = delete;
+
+    private:
+
+      RowLocks & locks;
+
+      std::list<Range>::iterator range;
+    };
+
+  private:
+
+    bool Granted(std::list<Range>::iterator range) const;
+
+  private:
+
+    // Held ranges and the ones waiting for them, oldest first
+    std::list<Range> ranges;
+
+    std::mutex mutex;
+
+    std::condition_variable cond;
+  };
+}
@@ -0,0 +1,398 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "Scrubber.h"
+#include "Volume.h"
+#include "Util.h"
+
+#include <stdio.h>
+#include <memory.h>
+#include <algorithm>
+
+namespace dfs
+{
+  // Foreground I/O within this many ms pauses the scrub.
+  static const uint64_t IDLE_DELAY = 500;
+
+
+  Scrubber::Scrubber(Volume * volume, uint64_t bytesPerSecond, uint32_t iops, uint32_t interval)
+    : volume(volume)
+    , bytesPerSecond(bytesPerSecond)
+    , iops(iops)
+    , interval(interval)
+    , progress{}
+    , scratch((volume->Columns() + volume->CodeCount() + volume->LocalCount() + 1) * volume->BlockSize())
+    , nextSlot(std::chrono::steady_clock::now())
+    , active(true)
+  {
+    progress.rows = volume->Rows();
+
+    this->thread = std::thread(std::bind(&Scrubber::ThreadProc, this));
+  }
+
+
+  Scrubber::~Scrubber()
+  {
+    if (this->active)
+    {
+      this->active = false;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.notify_all();
+      }
+
+      if (this->thread.joinable())
+      {
+        this->thread.join();
+      }
+    }
+  }
+
+
+  Scrubber::Progress Scrubber::GetProgress()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return progress;
+  }
+
+
+  void Scrubber::ThreadProc()
+  {
+    uint64_t rows = volume->Rows();
+    uint64_t cellCount = volume->Columns();
+
+    while (this->active)
+    {
+      uint64_t row = 0;
+
+      while (this->active)
+      {
+        if (volume->IdleTime() < IDLE_DELAY)
+        {
+          WaitFor(std::chrono::milliseconds(IDLE_DELAY));
+          continue;
+        }
+
+        uint64_t target = row;
+        bool repair = false;
+
+        {
+          std::unique_lock<std::mutex> lock(this->mutex);
+          if (!repairs.empty())
+          {
+            target = repairs.front();
+            repairs.pop_front();
+            repair = true;
+          }
+          else if (row >= rows)
+          {
+            break;
+          }
+        }
+
+        bool checked = ScrubRow(target, repair);
+
+        Throttle(cellCount * volume->BlockSize(), cellCount);
+
+        if (!repair)
+        {
+          std::unique_lock<std::mutex> lock(this->mutex);
+          progress.row = ++row;
+          ++(checked ? progress.scrubbed : progress.skipped);
+        }
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        ++progress.passes;
+      }
+
+      WaitFor(std::chrono::milliseconds(static_cast<uint64_t>(interval) * 1000));
+    }
+  }
+
+
+  bool Scrubber::WaitFor(std::chrono::milliseconds timeout)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cond.wait_for(lock, timeout, [this]() { return !this->active; });
+    return this->active;
+  }
+
+
+  void Scrubber::Throttle(uint64_t bytes, uint64_t ios)
+  {
+    uint64_t delay = 0;
+
+    if (bytesPerSecond > 0)
+    {
+      delay = bytes * 1000000 / bytesPerSecond;
+    }
+
+    if (iops > 0)
+    {
+      delay = std::max<uint64_t>(delay, ios * 1000000 / iops);
+    }
+
+    if (delay == 0)
+    {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    auto now = std::chrono::steady_clock::now();
+    if (nextSlot < now)
+    {
+      nextSlot = now;
+    }
+
+    nextSlot += std::chrono::microseconds(delay);
+
+    auto until = nextSlot;
+    this->cond.wait_until(lock, until, [this]() { return !this->active; });
+  }
+
+
+  bool Scrubber::ScrubRow(uint64_t row, bool repair)
+  {
+    size_t blockSize = volume->BlockSize();
+    uint64_t columns = volume->Columns();
+
+    // Unallocated rows hold nothing to check
+    if (!volume->IsAllocated(row))
+    {
+      return true;
+    }
+
+    // Rows still being rebuilt are not consistent yet, and rows being
+    // written are checked on the next pass.
+    if (!volume->IsRebuilt(row) || !volume->ClaimRow(row))
+    {
+      return false;
+    }
+
+    std::vector<bdfs::AsyncResultPtr<std::string>> reads;
+    std::vector<uint8_t *> cells;
+
+    for (uint64_t i = 0; i < columns; ++i)
+    {
+      reads.emplace_back(volume->partitions[i]->BeginReadBlock(row, blockSize, 0));
+      cells.push_back(scratch.data() + i * blockSize);
+    }
+
+    bool success = true;
+    bool verified = true;
+
+    for (uint64_t i = 0; i < columns; ++i)
+    {
+      success = volume->partitions[i]->EndReadBlock(reads[i], cells[i], blockSize) && success;
+      verified = verified && volume->partitions[i]->VerifyBlock(row);
+    }
+
+    if (!success || (verified && IsConsistent(cells)))
+    {
+      volume->ReleaseRow(row);
+      return success;
+    }
+
+    if (!repair)
+    {
+      volume->ReleaseRow(row);
+
+      std::unique_lock<std::mutex> lock(this->mutex);
+      ++progress.mismatches;
+      repairs.push_back(row);
+
+      printf("Warning: row '%lx' does not match its parity.\n", row);
+      return true;
+    }
+
+    if (!verified)
+    {
+      // The partitions know which cells are bad, so the row is decoded the
+      // same way a read of it would.
+      volume->ReleaseRow(row);
+      success = volume->GetRow(row).Decode();
+    }
+    else
+    {
+      uint64_t column = Locate(cells);
+      uint8_t * cell = scratch.data() + (scratch.size() - blockSize);
+
+      success = column != UINT64_MAX &&
+                RebuildCell(cells, column, cell) &&
+                volume->partitions[column]->WriteBlock(row, cell, blockSize, 0);
+
+      volume->ReleaseRow(row);
+
+      if (success)
+      {
+        printf("Repaired [%lx,%lx]\n", row, column);
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    ++(success ? progress.repaired : progress.unrepairable);
+
+    if (!success)
+    {
+      printf("Error: failed to repair row '%lx'.\n", row);
+    }
+
+    return true;
+  }
+
+
+  bool Scrubber::IsConsistent(const std::vector<uint8_t *> & cells)
+  {
+    const ErasureCoder * coder = volume->coder;
+    size_t blockSize = volume->BlockSize();
+    uint64_t dataCount = volume->DataCount();
+    uint64_t codeCount = volume->CodeCount();
+    uint8_t * code = scratch.data() + volume->Columns() * blockSize;
+
+    ErasureBlock blocks[256] = {};
+    for (uint64_t i = 0; i < dataCount; ++i)
+    {
+      blocks[i].buffer = cells[i];
+      blocks[i].index = i;
+    }
+
+    return_false_if(codeCount > 0 && !coder->Encode(dataCount, codeCount, blocks, code, blockSize));
+
+    for (uint64_t i = 0; i < codeCount; ++i)
+    {
+      return_false_if(memcmp(code + i * blockSize, cells[dataCount + i], blockSize) != 0);
+    }
+
+    for (uint64_t g = 0; g < volume->LocalCount(); ++g)
+    {
+      uint64_t begin = volume->LocalGroupBegin(g);
+
+      memcpy(code, cells[begin], blockSize);
+      for (uint64_t i = begin + 1; i < volume->LocalGroupBegin(g + 1); ++i)
+      {
+        coder->Add(code, cells[i], blockSize);
+      }
+
+      return_false_if(memcmp(code, cells[volume->LocalColumn(g)], blockSize) != 0);
+    }
+
+    return true;
+  }
+
+
+  // Computes what cell 'column' should hold from the other cells of the row.
+  bool Scrubber::RebuildCell(const std::vector<uint8_t *> & cells, uint64_t column, uint8_t * out)
+  {
+    const ErasureCoder * coder = volume->coder;
+    size_t blockSize = volume->BlockSize();
+    uint64_t dataCount = volume->DataCount();
+    uint64_t codeCount = volume->CodeCount();
+
+    if (column < dataCount && volume->LocalCount() == 0)
+    {
+      return_false_if(codeCount == 0);
+
+      ErasureBlock blocks[256] = {};
+      for (uint64_t i = 0; i < dataCount; ++i)
+      {
+        blocks[i].buffer = (i == column) ? out : cells[i];
+        blocks[i].index = (i == column) ? dataCount : i;
+      }
+
+      memcpy(out, cells[dataCount], blockSize);
+      return coder->Decode(dataCount, codeCount, blocks, blockSize);
+    }
+
+    if (column >= dataCount && column < dataCount + codeCount)
+    {
+      for (uint64_t i = 0; i < dataCount; ++i)
+      {
+        uint8_t c = ErasureCoder::Coefficient(dataCount, column - dataCount, i);
+        if (i == 0)
+        {
+          coder->Mul(out, cells[i], c, blockSize);
+        }
+        else
+        {
+          coder->MulAdd(out, cells[i], c, blockSize);
+        }
+      }
+      return true;
+    }
+
+    uint64_t group = (column < dataCount) ? volume->LocalGroupOf(column) : column - volume->LocalColumn(0);
+
+    memset(out, 0, blockSize);
+    for (uint64_t i = volume->LocalGroupBegin(group); i < volume->LocalGroupBegin(group + 1); ++i)
+    {
+      if (i != column)
+      {
+        coder->Add(out, cells[i], blockSize);
+      }
+    }
+
+    if (column < dataCount)
+    {
+      coder->Add(out, cells[volume->LocalColumn(group)], blockSize);
+    }
+
+    return true;
+  }
+
+
+  // Finds the one cell whose replacement by what the others say it should
+  // be makes the whole row consistent. Returns UINT64_MAX when there is no
+  // such cell or more than one, e.g. with a single parity column.
+  uint64_t Scrubber::Locate(std::vector<uint8_t *> & cells)
+  {
+    size_t blockSize = volume->BlockSize();
+    uint8_t * candidate = scratch.data() + (scratch.size() - blockSize);
+    uint64_t found = UINT64_MAX;
+
+    for (uint64_t i = 0; i < cells.size(); ++i)
+    {
+      if (!RebuildCell(cells, i, candidate) || memcmp(candidate, cells[i], blockSize) == 0)
+      {
+        continue;
+      }
+
+      std::swap(cells[i], candidate);
+      bool consistent = IsConsistent(cells);
+      std::swap(cells[i], candidate);
+
+      if (consistent)
+      {
+        if (found != UINT64_MAX)
+        {
+          return UINT64_MAX;
+        }
+        found = i;
+      }
+    }
+
+    return found;
+  }
+}
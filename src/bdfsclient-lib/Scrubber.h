@@ -0,0 +1,112 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+namespace dfs
+{
+  class Volume;
+
+  // Walks the rows of a volume in the background, reads every cell of each
+  // row and checks it against its parity, so corruption is found before a
+  // user reads it. A row that fails is queued for repair: when the bad cell
+  // can be told apart from the good ones it is rebuilt from them in place.
+  //
+  // Reads are spread to stay within 'bytesPerSecond' and 'iops' (0 for no
+  // limit) and stop while the volume has foreground I/O. Passes start
+  // 'interval' seconds apart.
+  class Scrubber
+  {
+  public:
+
+    struct Progress
+    {
+      uint64_t passes;
+      uint64_t row;
+      uint64_t rows;
+      uint64_t scrubbed;
+      uint64_t mismatches;
+      uint64_t repaired;
+      uint64_t unrepairable;
+      uint64_t skipped;
+    };
+
+    Scrubber(Volume * volume, uint64_t bytesPerSecond, uint32_t iops, uint32_t interval);
+
+    ~Scrubber();
+
+    Progress GetProgress();
+
+  private:
+
+    void ThreadProc();
+
+    bool WaitFor(std::chrono::milliseconds timeout);
+
+    void Throttle(uint64_t bytes, uint64_t ios);
+
+    // Returns false if the row could not be checked.
+    bool ScrubRow(uint64_t row, bool repair);
+
+    bool IsConsistent(const std::vector<uint8_t *> & cells);
+
+    bool RebuildCell(const std::vector<uint8_t *> & cells, uint64_t column, uint8_t * out);
+
+    uint64_t Locate(std::vector<uint8_t *> & cells);
+
+  private:
+
+    Volume * volume;
+
+    uint64_t bytesPerSecond;
+
+    uint32_t iops;
+
+    uint32_t interval;
+
+    Progress progress;
+
+    std::deque<uint64_t> repairs;
+
+    std::vector<uint8_t> scratch;
+
+    std::chrono::steady_clock::time_point nextSlot;
+
+    std::mutex mutex;
+
+    std::condition_variable cond;
+
+    std::thread thread;
+
+    std::atomic<bool> active;
+  };
+}
@@ -0,0 +1,186 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Volume.h"
+#include "StripeBuffer.h"
+
+namespace dfs
+{
+  // Sequential writers fill a row one data cell at a time. Instead of encoding
+  // the row after every request, the cells are held here until the row is
+  // complete, so its parity is computed from memory and all data and parity
+  // cells are written in one burst. A stripe that stays incomplete for longer
+  // than 'timeout' milliseconds is written out by the background thread.
+
+  StripeBuffer::StripeBuffer(Volume * volume, uint32_t timeout)
+    : volume(volume)
+    , timeout(timeout)
+    , active(true)
+  {
+    assert(volume);
+
+    this->buffer.reset(new uint8_t[volume->DataCount() * volume->BlockSize()]);
+
+    this->thread = std::thread(std::bind(&StripeBuffer::ThreadProc, this));
+  }
+
+
+  StripeBuffer::~StripeBuffer()
+  {
+    if (this->active)
+    {
+      this->active = false;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.notify_all();
+      }
+
+      if (this->thread.joinable())
+      {
+        this->thread.join();
+      }
+    }
+
+    this->Flush();
+  }
+
+
+  bool StripeBuffer::Accepts(uint64_t row, uint64_t column)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->count > 0 && this->row == row)
+    {
+      return this->count == column;
+    }
+
+    return column == 0;
+  }
+
+
+  bool StripeBuffer::Stage(uint64_t row, uint64_t column, const void * buffer, bool & staged)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    staged = false;
+
+    bool continues = this->count > 0 && this->row == row && this->count == column;
+
+    if (!continues)
+    {
+      // Anything that does not extend the pending stripe invalidates it for
+      // this row; a new stripe can only start at the first column.
+      if (this->count > 0 && (this->row == row || column == 0) && !this->FlushImpl())
+      {
+        return false;
+      }
+
+      if (column != 0)
+      {
+        return true;
+      }
+
+      this->row = row;
+      this->timestamp = std::chrono::steady_clock::now();
+    }
+
+    size_t blockSize = this->volume->BlockSize();
+    memcpy(this->buffer.get() + (column * blockSize), buffer, blockSize);
+    this->count = column + 1;
+    staged = true;
+
+    if (this->count == this->volume->DataCount())
+    {
+      return this->FlushImpl();
+    }
+
+    return true;
+  }
+
+
+  bool StripeBuffer::Flush(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->count == 0 || this->row != row)
+    {
+      return true;
+    }
+
+    return this->FlushImpl();
+  }
+
+
+  bool StripeBuffer::Flush()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->FlushImpl();
+  }
+
+
+  void StripeBuffer::ThreadProc()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (this->active)
+    {
+      this->cond.wait_for(lock, std::chrono::milliseconds(this->timeout));
+
+      if (this->count > 0 &&
+          std::chrono::steady_clock::now() - this->timestamp >= std::chrono::milliseconds(this->timeout))
+      {
+        this->FlushImpl();
+      }
+    }
+  }
+
+
+  bool StripeBuffer::FlushImpl()
+  {
+    if (this->count == 0)
+    {
+      return true;
+    }
+
+    size_t blockSize = this->volume->BlockSize();
+
+    std::vector<CellIo> cells;
+    for (uint64_t i = 0; i < this->count; ++i)
+    {
+      cells.push_back({i, this->buffer.get() + (i * blockSize), blockSize, 0, false});
+    }
+
+    if (!this->volume->GetRow(this->row).Encode(cells))
+    {
+      printf("Error: failed to write stripe of row '%lx'.\n", (unsigned long)this->row);
+      return false;
+    }
+
+    this->count = 0;
+
+    return true;
+  }
+}
@@ -0,0 +1,81 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+
+namespace dfs
+{
+  class Volume;
+
+  class StripeBuffer
+  {
+  public:
+
+    explicit StripeBuffer(Volume * volume, uint32_t timeout = 1000);
+
+    ~StripeBuffer();
+
+    bool Accepts(uint64_t row, uint64_t column);
+
+    bool Stage(uint64_t row, uint64_t column, const void * buffer, bool & staged);
+
+    bool Flush(uint64_t row);
+
+    bool Flush();
+
+  private:
+
+    void ThreadProc();
+
+    bool FlushImpl();
+
+  private:
+
+    Volume * volume;
+
+    uint32_t timeout;
+
+    std::unique_ptr<uint8_t[]> buffer;
+
+    uint64_t row = 0;
+
+    uint64_t count = 0;
+
+    std::chrono::steady_clock::time_point timestamp;
+
+    std::mutex mutex;
+
+    std::thread thread;
+
+    std::condition_variable cond;
+
+    std::atomic<bool> active;
+  };
+}
@@ -25,10 +25,15 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <cerrno>
 #include <memory>
 #include <sstream>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
 uint64_t htonll(uint64_t val)
 {
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
@@ -96,3 +101,65 @@ std::string execCmd(std::string cmd)
   }
   return result;
 }
+
+
+int mkpath(char* path, mode_t mode)
+{
+  char * p = path;
+
+  do
+  {
+    p = strchr(p + 1, '/');
+    if (p)
+    {
+      *p = '\0';
+    }
+
+    int rtn = mkdir(path, mode);
+
+    if (p)
+    {
+      *p = '/';
+    }
+
+    if (rtn == -1 && errno != EEXIST)
+    {
+      return -1;
+    }
+  } while (p);
+
+  return 0;
+}
+
+
+bool IsZero(const void * buffer, size_t size)
+{
+  const uint8_t * bytes = static_cast<const uint8_t *>(buffer);
+  size_t i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+  // 64 bytes are or-ed together per step, so non-zero data bails out early
+  // without a branch per vector.
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 64 <= size; i += 64)
+  {
+    const __m128i * v = reinterpret_cast<const __m128i *>(bytes + i);
+    __m128i x = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(v), _mm_loadu_si128(v + 1)),
+                             _mm_or_si128(_mm_loadu_si128(v + 2), _mm_loadu_si128(v + 3)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff)
+    {
+      return false;
+    }
+  }
+#endif
+
+  for (; i < size; ++i)
+  {
+    if (bytes[i] != 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
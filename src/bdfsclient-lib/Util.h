@@ -23,6 +23,7 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <sys/types.h>
 #include <string>
 
 #define return_false_if(condition) \
@@ -35,3 +36,5 @@ uint64_t htonll(uint64_t val);
 uint64_t ntohll(uint64_t val);
 bool nbd_ready(const char* devname, bool do_print = false);
 std::string execCmd(std::string cmd);
+int mkpath(char* path, mode_t mode);
+bool IsZero(const void * buffer, size_t size);
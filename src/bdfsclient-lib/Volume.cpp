@@ -23,21 +23,60 @@
 #include "Volume.h"
 #include "Util.h"
 #include "Cache.h"
+#include "StripeBuffer.h"
+#include "Rebuilder.h"
+#include "Scrubber.h"
+#include "ReadAhead.h"
+#include "BlockCipher.h"
+#include "WorkerPool.h"
+#include "Compressor.h"
+#include "LazyParity.h"
+#include "BitSet.h"
 
 #include <memory.h>
 #include <memory>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <unistd.h>
 #include <openssl/sha.h>
 
 namespace dfs
 {
-  Volume::Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password) :
+  // Bounds the ciphertext a single WriteEncrypt or ReadDecrypt keeps in
+  // flight on the crypto pool.
+  static const size_t MAX_CRYPTO_CELLS = 256;
+
+  // Scratch buffers kept around per volume, see BufferPool.
+  static const size_t BLOCK_POOL_SIZE = 64;
+  static const size_t ROW_POOL_SIZE = 8;
+
+  // Plaintext header of a compressed cell, in network byte order.
+  struct CellHeader
+  {
+    uint32_t magic;
+    uint32_t codec;
+    uint32_t size;
+    uint32_t reserved;
+  };
+
+  static const uint32_t CELL_MAGIC = 0x44465a43;
+
+  Volume::Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password, uint64_t localCount) :
     zeroBuffer(NULL),
     volumeId(volumeId),
     blockCount(blockCount),
     dataCount(dataCount),
     codeCount(codeCount),
+    localCount(std::min(localCount, dataCount)),
     blockSize(blockSize),
-    partitions(dataCount+codeCount)
+    partitions(dataCount+codeCount+this->localCount),
+    coder(ErasureCoder::Get()),
+    blockPool(blockSize, BLOCK_POOL_SIZE),
+    rowPool((dataCount+codeCount+this->localCount) * blockSize, ROW_POOL_SIZE, (dataCount+codeCount+this->localCount) * blockSize >= BufferPool::HUGE_PAGE_SIZE),
+    rebuildActive(0),
+    foregroundTime(0)
   {
     if (password != NULL)
     {
@@ -48,12 +87,22 @@ namespace dfs
       SHA256_Final(key, &sha256);
       AES_set_encrypt_key(key, 128, &(encryptKey));
       AES_set_decrypt_key(key, 128, &(decryptKey));
+      cipher.reset(new BlockCipher(password));
     }
   }
 
   Volume::~Volume()
   {
+    this->readAhead.reset();
+    this->scrubber.reset();
+    this->lazyParity.reset();
+    this->stripe.reset();
     this->cache.reset();
+    this->rebuilders.clear();
+    if (this->allocationFile != nullptr)
+    {
+      fclose(this->allocationFile);
+    }
     for (std::vector<Partition*>::iterator i = partitions.begin(); i != partitions.end(); i++)
     {
       delete(*i);
@@ -61,12 +110,510 @@ namespace dfs
   }
 
 
+  bool Volume::SetErasureCoder(const std::string & name)
+  {
+    const ErasureCoder * val = ErasureCoder::Get(name);
+    return_false_if_msg(val == nullptr, "Error: erasure coder '%s' is not available.\n", name.c_str());
+    this->coder = val;
+    return true;
+  }
+
+
+  bool Volume::SetCryptoVersion(uint32_t version)
+  {
+    return_false_if_msg(version > CRYPTO_XTS, "Error: crypto version %u is not supported.\n", version);
+    return_false_if_msg(version == CRYPTO_XTS && !cipher, "Error: crypto version %u needs a password.\n", version);
+    this->xts = version == CRYPTO_XTS;
+    return true;
+  }
+
+
+  bool Volume::SetCompression(const std::string & name)
+  {
+    const Compressor * val = Compressor::Get(name);
+    return_false_if_msg(val == nullptr, "Error: compression '%s' is not available.\n", name.c_str());
+    return_false_if_msg(blockSize < 2 * BlockCipher::SECTOR_SIZE, "Error: blocks of %zu bytes are too small to compress.\n", blockSize);
+    this->compressor = val;
+    return true;
+  }
+
+
   void Volume::EnableCache(std::unique_ptr<Cache> val)
   {
     this->cache = std::move(val);
   }
 
 
+  void Volume::EnableStripe(std::unique_ptr<StripeBuffer> val)
+  {
+    this->stripe = std::move(val);
+  }
+
+
+  void Volume::EnableScrub(std::unique_ptr<Scrubber> val)
+  {
+    this->scrubber = std::move(val);
+  }
+
+
+  void Volume::EnableReadAhead(std::unique_ptr<ReadAhead> val)
+  {
+    this->readAhead = std::move(val);
+  }
+
+
+  void Volume::EnableWorkers(std::unique_ptr<WorkerPool> val)
+  {
+    workers = std::move(val);
+  }
+
+
+  void Volume::EnableCryptoPool(std::unique_ptr<WorkerPool> val)
+  {
+    this->crypto = std::move(val);
+  }
+
+
+  void Volume::MarkForeground()
+  {
+    foregroundTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+
+  uint64_t Volume::IdleTime()
+  {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return static_cast<uint64_t>(std::max<int64_t>(now - foregroundTime, 0));
+  }
+
+
+  Volume::RowWrite::RowWrite(Volume * volume, uint64_t row) :
+    volume(volume),
+    row(row)
+  {
+    std::unique_lock<std::mutex> lock(volume->writingMutex);
+    volume->writingCond.wait(lock, [volume, row]() { return volume->claimedRows.count(row) == 0; });
+    volume->writingRows.insert(row);
+  }
+
+
+  Volume::RowWrite::~RowWrite()
+  {
+    std::unique_lock<std::mutex> lock(volume->writingMutex);
+    volume->writingRows.erase(volume->writingRows.find(row));
+  }
+
+
+  // Rows waiting for their parity count as being written.
+  bool Volume::IsWriting(uint64_t row)
+  {
+    if (lazyParity && lazyParity->IsDirty(row))
+    {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(writingMutex);
+    return writingRows.count(row) > 0;
+  }
+
+
+  bool Volume::ClaimRow(uint64_t row)
+  {
+    if (lazyParity && lazyParity->IsDirty(row))
+    {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock(writingMutex);
+    if (writingRows.count(row) > 0 || claimedRows.count(row) > 0)
+    {
+      return false;
+    }
+
+    claimedRows.insert(row);
+    return true;
+  }
+
+
+  void Volume::ReleaseRow(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(writingMutex);
+    claimedRows.erase(row);
+    writingCond.notify_all();
+  }
+
+
+  bool Volume::IsClaimed(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(writingMutex);
+    return claimedRows.count(row) > 0;
+  }
+
+
+  // Marks a row as being written for as long as a write-back of it is under
+  // way, across the cells it uploads one by one. Unlike RowWrite this does
+  // not wait for a claim taken before, so WriteBack holds the cells of a
+  // claimed row back itself.
+  void Volume::BeginWriting(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(writingMutex);
+    writingRows.insert(row);
+  }
+
+
+  void Volume::EndWriting(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(writingMutex);
+    writingRows.erase(writingRows.find(row));
+  }
+
+
+  void Volume::EnableHedging(double percentile)
+  {
+    this->hedgePercentile = percentile;
+  }
+
+
+  void Volume::EnableRebuild(const std::string & path, size_t workers, size_t batch, uint32_t rowsPerSecond)
+  {
+    this->rebuildPath = path;
+    this->rebuildWorkers = workers;
+    this->rebuildBatch = batch;
+    this->rebuildRate = rowsPerSecond;
+
+    if (rebuildPath.empty())
+    {
+      return;
+    }
+
+    if (rebuildPath[rebuildPath.size() - 1] == '/')
+    {
+      rebuildPath.resize(rebuildPath.size() - 1);
+    }
+
+    mkpath(const_cast<char *>(rebuildPath.c_str()), 0755);
+
+    for (uint64_t i = 0; i < partitions.size(); ++i)
+    {
+      if (access((rebuildPath + "/" + std::to_string(i)).c_str(), F_OK) == 0)
+      {
+        StartRebuild(i, true);
+      }
+    }
+  }
+
+
+  void Volume::StartRebuild(uint64_t column, bool resume)
+  {
+    std::string path = rebuildPath.empty() ? "" : rebuildPath + "/" + std::to_string(column);
+    std::unique_ptr<Rebuilder> old;
+
+    {
+      std::unique_lock<std::mutex> lock(rebuildMutex);
+      auto it = rebuilders.find(column);
+      if (it != rebuilders.end())
+      {
+        old = std::move(it->second);
+        rebuilders.erase(it);
+      }
+    }
+
+    // The old rebuilder keeps answering for the column until it is replaced
+    // below, it only stops writing to it.
+    if (old)
+    {
+      old->Discard();
+    }
+
+    std::unique_ptr<Rebuilder> rebuilder(new Rebuilder(this, column, path, resume, rebuildWorkers, rebuildBatch, rebuildRate));
+
+    std::unique_lock<std::mutex> lock(rebuildMutex);
+    rebuilders[column] = std::move(rebuilder);
+  }
+
+
+  bool Volume::IsRebuilt(uint64_t row)
+  {
+    if (rebuildActive == 0)
+    {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(rebuildMutex);
+    for (auto & it : rebuilders)
+    {
+      if (!it.second->IsRebuilt(row))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  bool Volume::IsRebuilt(uint64_t row, uint64_t column)
+  {
+    if (rebuildActive == 0)
+    {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(rebuildMutex);
+    auto it = rebuilders.find(column);
+    return it == rebuilders.end() || it->second->IsRebuilt(row);
+  }
+
+
+  // Called once the row has been decoded, which restores every cell the
+  // rebuilds still had to do.
+  void Volume::MarkRebuilt(uint64_t row)
+  {
+    if (rebuildActive == 0)
+    {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(rebuildMutex);
+    for (auto & it : rebuilders)
+    {
+      it.second->MarkRebuilt(row);
+    }
+  }
+
+
+  bool Volume::EnableLazyParity(const std::string & path, size_t workers)
+  {
+    std::unique_ptr<LazyParity> val(new LazyParity(this, workers));
+    return_false_if(!val->Open(path));
+    this->lazyParity = std::move(val);
+    return true;
+  }
+
+
+  bool Volume::Flush()
+  {
+    return_false_if(stripe && !stripe->Flush());
+
+    return !cache || cache->Sync();
+  }
+
+
+  bool Volume::FlushStripe(uint64_t row)
+  {
+    return !stripe || stripe->Flush(row);
+  }
+
+
+  bool Volume::EnableAllocationMap(const std::string & path)
+  {
+    std::unique_ptr<BitSet> map(new BitSet(blockCount));
+
+    FILE * file = fopen(path.c_str(), "rb+");
+    if (file != nullptr)
+    {
+      map->ReadFrom(file);
+    }
+    else
+    {
+      file = fopen(path.c_str(), "wb+");
+      return_false_if_msg(file == nullptr, "Error: failed to create allocation map '%s'.\n", path.c_str());
+
+      for (uint64_t row = 0; row < blockCount; ++row)
+      {
+        map->__Set(row, true);
+      }
+      map->WriteTo(file);
+      fflush(file);
+    }
+
+    std::unique_lock<std::mutex> lock(allocationMutex);
+    if (this->allocationFile != nullptr)
+    {
+      fclose(this->allocationFile);
+    }
+    this->allocated = std::move(map);
+    this->allocationFile = file;
+    return true;
+  }
+
+
+  bool Volume::IsAllocated(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(allocationMutex);
+    return !allocated || allocated->__Get(row);
+  }
+
+
+  // The map is synced before the caller goes on, so that a row never reads
+  // as zeros after data was written to it.
+  bool Volume::SetAllocated(uint64_t row, bool value)
+  {
+    std::unique_lock<std::mutex> lock(allocationMutex);
+    if (!allocated || allocated->__Get(row) == value)
+    {
+      return true;
+    }
+
+    allocated->__Set(row, value);
+    allocated->WriteWordTo(allocationFile, row);
+    return_false_if_msg(fflush(allocationFile) != 0 || fdatasync(fileno(allocationFile)) != 0, "Error: failed to save allocation map.\n");
+    return true;
+  }
+
+
+  // Called by writers before they touch the row. The cells of an unallocated
+  // row hold zeros or leftovers of trimmed data, so unless the write covers
+  // every data cell the row is first written out as zeros, encrypted if the
+  // write is, with matching parity.
+  bool Volume::AllocateRow(uint64_t row, bool encrypted, bool overwritten)
+  {
+    if (IsAllocated(row))
+    {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(allocateMutex);
+    if (IsAllocated(row))
+    {
+      return true;
+    }
+
+    if (!overwritten)
+    {
+      return_false_if_msg(!FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
+
+      BufferPool::Buffer buffer = rowPool.Acquire(dataCount * blockSize);
+      memset(buffer.get(), 0, dataCount * blockSize);
+
+      std::vector<CellIo> cells;
+      for (uint64_t col = 0; col < dataCount; ++col)
+      {
+        uint8_t * cell = buffer.get() + (col * blockSize);
+        if (encrypted)
+        {
+          return_false_if(!SealCell(row, col, cell, cell));
+        }
+        cells.push_back({col, cell, blockSize, 0, false});
+      }
+
+      return_false_if(!GetRow(row).Encode(cells));
+      MarkRebuilt(row);
+    }
+
+    return SetAllocated(row, true);
+  }
+
+
+  bool Volume::Trim(size_t offset, size_t size)
+  {
+    size_t rowSize = dataCount * blockSize;
+
+    return_false_if_msg((offset+size) > (blockCount*rowSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+
+    for (uint64_t row = (offset + rowSize - 1) / rowSize; row < (offset + size) / rowSize; ++row)
+    {
+      TrimRow(row);
+    }
+
+    return true;
+  }
+
+
+  // Trimming is advisory, so a row that is being written or rebuilt just
+  // keeps its data. The row is locked like a write and claimed before its
+  // cached cells are dropped, so that none of them is lost to a row that
+  // stays allocated. The bit is cleared before the cells are released, which
+  // leaves the row reading as zeros however far that gets.
+  void Volume::TrimRow(uint64_t row)
+  {
+    RowLocks::Guard lock(rowLocks, row, row, true);
+
+    if (!IsAllocated(row) || !FlushStripe(row) || !ClaimRow(row))
+    {
+      return;
+    }
+
+    if (cache)
+    {
+      cache->Discard(row);
+    }
+
+    if (SetAllocated(row, false))
+    {
+      std::vector<bdfs::AsyncResultPtr<bool>> results;
+      for (auto partition : partitions)
+      {
+        results.push_back(partition->BeginTrimBlock(row, blockSize, 0));
+      }
+
+      for (size_t i = 0; i < partitions.size(); ++i)
+      {
+        if (!partitions[i]->EndTrimBlock(results[i]))
+        {
+          printf("Warning: failed to trim [%lx,%lx].\n", row, i);
+        }
+      }
+    }
+
+    ReleaseRow(row);
+  }
+
+
+  // Unlike trimming this is part of a write, so it waits for the row instead
+  // of giving up, and leaves the stale cells where they are.
+  bool Volume::DeallocateRow(uint64_t row)
+  {
+    RowWrite writing(this, row);
+
+    return_false_if(!FlushStripe(row));
+
+    if (cache)
+    {
+      return_false_if(!cache->Discard(row));
+    }
+
+    return SetAllocated(row, false);
+  }
+
+
+  // Zeros written to an unallocated row change nothing, and a row that is
+  // overwritten with zeros as a whole only needs to be deallocated, so
+  // neither costs any I/O. Returns how many leading bytes of the write were
+  // taken care of this way.
+  size_t Volume::ElideZeroRows(const uint8_t * buffer, size_t size, size_t offset)
+  {
+    {
+      std::unique_lock<std::mutex> lock(allocationMutex);
+      if (!allocated)
+      {
+        return 0;
+      }
+    }
+
+    size_t rowSize = dataCount * blockSize;
+    size_t elided = 0;
+    while (elided < size)
+    {
+      uint64_t row = (offset + elided) / rowSize;
+      size_t span = std::min(size - elided, rowSize - ((offset + elided) % rowSize));
+
+      if (!IsZero(buffer + elided, span))
+      {
+        break;
+      }
+      if (IsAllocated(row) && (span < rowSize || !DeallocateRow(row)))
+      {
+        break;
+      }
+
+      elided += span;
+    }
+
+    return elided;
+  }
+
+
   bool Volume::SetPartition(uint64_t index, Partition * partition)
   {
     if (partition == NULL ||
@@ -84,8 +631,8 @@ namespace dfs
 
     if (oldPartition != NULL)
     {
-      // need to rebuild.
       delete(oldPartition);
+      StartRebuild(index, false);
     }
 
     return true;
@@ -100,40 +647,433 @@ namespace dfs
       result += partition->GetTimeout();
     }
 
-    return result;
+    return result;
+  }
+
+
+  const PartitionHealth * Volume::GetHealth(uint64_t column) const
+  {
+    if (column >= partitions.size() || partitions[column] == NULL)
+    {
+      return nullptr;
+    }
+
+    return &partitions[column]->Health();
+  }
+
+
+  std::string Volume::GetHost(uint64_t column) const
+  {
+    if (column >= partitions.size() || partitions[column] == NULL)
+    {
+      return std::string();
+    }
+
+    return partitions[column]->Host();
+  }
+
+
+  const uint8_t * Volume::GetZeroBuffer()
+  {
+    if (zeroBuffer == NULL)
+    {
+      zeroBuffer = new uint8_t[blockSize];
+    }
+    return zeroBuffer;
+  }
+
+  Volume::Column Volume::GetColumn(uint64_t column)
+  {
+    return Column(this, column);
+  }
+
+  Volume::Row Volume::GetRow(uint64_t row)
+  {
+    return Row(this, row);
+  }
+
+  Volume::Cell Volume::GetCell(uint64_t row, uint64_t column)
+  {
+    return Cell(this, row, column);
+  }
+
+  // Turns 'cell', which holds the new content of the cell, into the xor delta
+  // against 'old' and narrows it to the byte range that actually changed.
+  static void MakeDelta(const ErasureCoder * coder, CellIo & cell, const uint8_t * old)
+  {
+    uint8_t * delta = static_cast<uint8_t *>(cell.buffer);
+    coder->Add(delta, old, cell.size);
+
+    size_t begin = 0;
+    size_t end = cell.size;
+    while (begin < end && delta[begin] == 0) { ++begin; }
+    while (end > begin && delta[end - 1] == 0) { --end; }
+
+    cell.buffer = delta + begin;
+    cell.offset += begin;
+    cell.size = end - begin;
+  }
+
+
+  // The part of a cell that has to be encrypted or decrypted to access
+  // 'size' bytes at 'blockOffset': CBC chains the whole cell, XTS only needs
+  // the sectors that are touched.
+  void Volume::CryptRange(size_t blockOffset, size_t size, size_t & begin, size_t & end)
+  {
+    begin = 0;
+    end = blockSize;
+    if (xts && !compressor)
+    {
+      begin = blockOffset - (blockOffset % BlockCipher::SECTOR_SIZE);
+      end = blockOffset + size + (BlockCipher::SECTOR_SIZE - 1);
+      end -= end % BlockCipher::SECTOR_SIZE;
+    }
+  }
+
+
+  bool Volume::EncryptCell(uint64_t row, uint64_t column, const uint8_t * in, uint8_t * out, size_t size, size_t offset)
+  {
+    if (xts)
+    {
+      return cipher->Encrypt(row, column, in, out, size, offset);
+    }
+
+    return_false_if(offset != 0 || size > blockSize || size % AES_BLOCK_SIZE != 0);
+    uint8_t iv[AES_BLOCK_SIZE];
+    memset(iv, row, AES_BLOCK_SIZE);
+    AES_cbc_encrypt(in, out, size, &encryptKey, iv, AES_ENCRYPT);
+    return true;
+  }
+
+
+  bool Volume::DecryptCell(uint64_t row, uint64_t column, const uint8_t * in, uint8_t * out, size_t size, size_t offset)
+  {
+    if (xts)
+    {
+      return cipher->Decrypt(row, column, in, out, size, offset);
+    }
+
+    return_false_if(offset != 0 || size > blockSize || size % AES_BLOCK_SIZE != 0);
+    uint8_t iv[AES_BLOCK_SIZE];
+    memset(iv, row, AES_BLOCK_SIZE);
+    AES_cbc_encrypt(in, out, size, &decryptKey, iv, AES_DECRYPT);
+    return true;
+  }
+
+
+  // A compressed cell holds its header and payload, encrypted and padded to
+  // the cipher unit, followed by zeros that the partitions keep as a hole.
+  // Cells that would not save a sector, judged by their first sector before
+  // the whole cell is tried, are encrypted as they are.
+  bool Volume::SealCell(uint64_t row, uint64_t column, const uint8_t * clear, uint8_t * stored)
+  {
+    if (compressor)
+    {
+      BufferPool::Buffer packed = blockPool.Acquire();
+      uint8_t * payload = packed.get() + sizeof(CellHeader);
+      size_t sample = BlockCipher::SECTOR_SIZE;
+      size_t size = 0;
+
+      if (compressor->Compress(clear, sample, payload, sample - sample / 8) > 0)
+      {
+        size = compressor->Compress(clear, blockSize, payload, blockSize - BlockCipher::SECTOR_SIZE - sizeof(CellHeader));
+      }
+
+      if (size > 0)
+      {
+        CellHeader header = { htonl(CELL_MAGIC), htonl(compressor->Id()), htonl(static_cast<uint32_t>(size)), 0 };
+        memcpy(packed.get(), &header, sizeof(header));
+
+        size_t unit = xts ? BlockCipher::SECTOR_SIZE : AES_BLOCK_SIZE;
+        size_t used = (sizeof(header) + size + unit - 1) / unit * unit;
+        memset(payload + size, 0, used - sizeof(header) - size);
+
+        return_false_if(!EncryptCell(row, column, packed.get(), stored, used, 0));
+        memset(stored + used, 0, blockSize - used);
+        return true;
+      }
+    }
+
+    return EncryptCell(row, column, clear, stored, blockSize, 0);
+  }
+
+
+  // Ciphertext ends in a zero AES block with negligible odds, so a zero tail
+  // marks a compressed cell. 'stored' and 'clear' may be the same buffer.
+  bool Volume::OpenCell(uint64_t row, uint64_t column, const uint8_t * stored, uint8_t * clear)
+  {
+    if (compressor && IsZero(stored + blockSize - AES_BLOCK_SIZE, AES_BLOCK_SIZE))
+    {
+      BufferPool::Buffer packed = blockPool.Acquire();
+      size_t unit = xts ? BlockCipher::SECTOR_SIZE : AES_BLOCK_SIZE;
+      return_false_if(!DecryptCell(row, column, stored, packed.get(), unit, 0));
+
+      CellHeader header;
+      memcpy(&header, packed.get(), sizeof(header));
+      size_t size = ntohl(header.size);
+
+      if (ntohl(header.magic) == CELL_MAGIC && size <= blockSize - BlockCipher::SECTOR_SIZE - sizeof(header))
+      {
+        size_t used = (sizeof(header) + size + unit - 1) / unit * unit;
+        if (used > unit)
+        {
+          return_false_if(!DecryptCell(row, column, stored, packed.get(), used, 0));
+        }
+
+        const Compressor * codec = Compressor::Get(static_cast<uint8_t>(ntohl(header.codec)));
+        return_false_if_msg(codec == nullptr || !codec->Decompress(packed.get() + sizeof(header), size, clear, blockSize), "Error: cell [%lx,%lx] does not decompress.\n", row, column);
+        return true;
+      }
+    }
+
+    return DecryptCell(row, column, stored, clear, blockSize, 0);
+  }
+
+
+  // How much of a stored cell has to be uploaded. A compressed cell is only
+  // used up to its padded payload and its parity mostly ends in zeros too,
+  // which the host can trim rather than receive. That costs a second request,
+  // so a tail of less than a quarter of the cell is uploaded anyway.
+  size_t Volume::StoredSize(const void * stored, size_t size, size_t offset) const
+  {
+    if (!compressor || offset != 0 || size != blockSize)
+    {
+      return size;
+    }
+
+    const uint8_t * bytes = static_cast<const uint8_t *>(stored);
+    size_t used = size;
+    while (used >= BlockCipher::SECTOR_SIZE && IsZero(bytes + used - BlockCipher::SECTOR_SIZE, BlockCipher::SECTOR_SIZE))
+    {
+      used -= BlockCipher::SECTOR_SIZE;
+    }
+
+    return (size - used >= size / 4) ? used : size;
+  }
+
+
+  // Parity of a partially written row can either be recomputed from all of
+  // its data cells (Row::Encode) or patched with the difference between the
+  // old and new content of the written cells (Row::Update). Pick the one that
+  // reads fewer cells.
+  bool Volume::PreferUpdate(uint64_t col, size_t blockOffset, size_t size, bool partialIsRead)
+  {
+    if (lazyParity)
+    {
+      // The parity is encoded from scratch later on anyway
+      return false;
+    }
+
+    uint64_t touched = 0;
+    uint64_t oldReads = 0;
+    uint64_t groups = 0;
+
+    for (; col < dataCount && size > 0; ++col)
+    {
+      if (localCount > 0 && (touched == 0 || col == LocalGroupBegin(LocalGroupOf(col))))
+      {
+        ++groups;
+      }
+
+      size_t toWrite = std::min(size, blockSize - blockOffset);
+      if (toWrite == blockSize || !partialIsRead)
+      {
+        ++oldReads;
+      }
+      ++touched;
+      size -= toWrite;
+      blockOffset = 0;
+    }
+
+    return codeCount + groups + oldReads < dataCount - touched;
+  }
+
+
+  bool Volume::UpdateParity(uint64_t row, const std::vector<CellIo> & deltas, bool update)
+  {
+    if (lazyParity)
+    {
+      lazyParity->Schedule(row);
+      return true;
+    }
+
+    if (update)
+    {
+      return GetRow(row).Update(deltas);
+    }
+
+    return GetRow(row).Encode();
+  }
+
+
+  // Called before the first data cell of a row is written directly, so that
+  // the row is journaled before its parity goes stale.
+  bool Volume::DeferParity(uint64_t row)
+  {
+    return !lazyParity || lazyParity->MarkDirty(row);
+  }
+
+
+  bool Volume::WriteEncrypt(const void * buffer, size_t size, size_t offset)
+  {
+    return Serve((uint8_t*)buffer, size, offset, true, [this](uint8_t * buffer, size_t size, size_t offset) {
+      return WholeRow(size, offset) ? WriteRow(buffer, offset / (dataCount * blockSize), true) : WriteEncryptRows(buffer, size, offset);
+    });
+  }
+
+
+  bool Volume::Write(const void * buffer, size_t size, size_t offset)
+  {
+    return Serve((uint8_t*)buffer, size, offset, true, [this](uint8_t * buffer, size_t size, size_t offset) {
+      return WholeRow(size, offset) ? WriteRow(buffer, offset / (dataCount * blockSize), false) : WriteRows(buffer, size, offset);
+    });
+  }
+
+
+  bool Volume::ReadDecrypt(void * buffer, size_t size, size_t offset)
+  {
+    return Serve((uint8_t*)buffer, size, offset, false, [this](uint8_t * buffer, size_t size, size_t offset) {
+      return ReadDecryptRows(buffer, size, offset);
+    });
+  }
+
+
+  bool Volume::Read(void * buffer, size_t size, size_t offset)
+  {
+    return Serve((uint8_t*)buffer, size, offset, false, [this](uint8_t * buffer, size_t size, size_t offset) {
+      return ReadRows(buffer, size, offset);
+    });
+  }
+
+
+  bool Volume::WholeRow(size_t size, size_t offset) const
+  {
+    return size == dataCount * blockSize && offset % size == 0;
+  }
+
+
+  // Locks the rows of the request, shared for reads, and hands 'io' one row
+  // at a time to the workers so that rows are fetched, decoded and encoded
+  // in parallel. Writes are split into rows even without workers, since
+  // whole rows take the WriteRow shortcut.
+  bool Volume::Serve(uint8_t * buffer, size_t size, size_t offset, bool write, const std::function<bool(uint8_t *, size_t, size_t)> & io)
+  {
+    if (size == 0) { return true; }
+
+    MarkForeground();
+
+    return_false_if_msg(offset >= (blockCount*dataCount*blockSize), "Error: param 'offset' out of range: %ld\n", offset);
+    return_false_if_msg(size > (blockCount*dataCount*blockSize), "Error: param 'size' out of range: %ld\n", offset);
+    return_false_if_msg((offset+size) > (blockCount*dataCount*blockSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+
+    if (readAhead && !write)
+    {
+      readAhead->Observe(offset, size);
+    }
+
+    size_t rowSize = dataCount * blockSize;
+    uint64_t first = offset / rowSize;
+    uint64_t last = (offset + size - 1) / rowSize;
+
+    RowLocks::Guard lock(rowLocks, first, last, write);
+
+    if (first == last || (!workers && !write))
+    {
+      return io(buffer, size, offset);
+    }
+
+    std::unique_ptr<WorkerPool::Batch> batch;
+    if (workers)
+    {
+      batch.reset(new WorkerPool::Batch(workers.get()));
+    }
+
+    bool success = true;
+    while (size > 0)
+    {
+      size_t toServe = std::min(size, rowSize - (offset % rowSize));
+      if (batch)
+      {
+        batch->Submit([&io, buffer, toServe, offset]() { return io(buffer, toServe, offset); });
+      }
+      else
+      {
+        success = success && io(buffer, toServe, offset);
+      }
+      buffer += toServe;
+      offset += toServe;
+      size -= toServe;
+    }
+
+    return (!batch || batch->Wait()) && success;
   }
 
 
-  const uint8_t * Volume::GetZeroBuffer()
+  // A write covering a whole row needs neither the old content nor the
+  // stripe buffer: its parity is encoded from memory and every cell goes out
+  // in one burst.
+  bool Volume::WriteRow(const uint8_t * buffer, uint64_t row, bool encrypted)
   {
-    if (zeroBuffer == NULL)
+    size_t rowSize = dataCount * blockSize;
+    if (ElideZeroRows(buffer, rowSize, row * rowSize) > 0)
     {
-      zeroBuffer = new uint8_t[blockSize];
+      return true;
     }
-    return zeroBuffer;
-  }
 
-  Volume::Column Volume::GetColumn(uint64_t column)
-  {
-    return Column(this, column);
-  }
+    RowWrite writing(this, row);
 
-  Volume::Row Volume::GetRow(uint64_t row)
-  {
-    return Row(this, row);
-  }
+    return_false_if_msg(!AllocateRow(row, encrypted, true), "Error: failed to allocate row '%lx'.\n", row);
+    return_false_if_msg(!FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
 
-  Volume::Cell Volume::GetCell(uint64_t row, uint64_t column)
-  {
-    return Cell(this, row, column);
+    BufferPool::Buffer sealedBuffer;
+    if (encrypted)
+    {
+      sealedBuffer = rowPool.Acquire(rowSize);
+      std::unique_ptr<WorkerPool::Batch> batch;
+      if (crypto)
+      {
+        batch.reset(new WorkerPool::Batch(crypto.get()));
+      }
+
+      for (uint64_t col = 0; col < dataCount; ++col)
+      {
+        const uint8_t * in = buffer + (col * blockSize);
+        uint8_t * out = sealedBuffer.get() + (col * blockSize);
+        if (batch)
+        {
+          batch->Submit([this, row, col, in, out]() {
+            return SealCell(row, col, in, out);
+          });
+        }
+        else
+        {
+          return_false_if(!SealCell(row, col, in, out));
+        }
+      }
+
+      return_false_if_msg(batch && !batch->Wait(), "Error: failed to write row '%lx'.\n", row);
+      buffer = sealedBuffer.get();
+    }
+
+    std::vector<CellIo> cells;
+    for (uint64_t col = 0; col < dataCount; ++col)
+    {
+      cells.push_back({col, const_cast<uint8_t *>(buffer) + (col * blockSize), blockSize, 0, false});
+    }
+
+    return_false_if_msg(!GetRow(row).Encode(cells), "Error: row '%lx' could not be encoded.\n", row);
+
+    MarkRebuilt(row);
+    return !lazyParity || lazyParity->MarkClean(row);
   }
 
-  bool Volume::WriteEncrypt(const void * buffer, size_t size, size_t offset)
+
+  bool Volume::WriteEncryptRows(const void * buffer, size_t size, size_t offset)
   {
     if (size == 0) { return true; }
 
-    std::unique_ptr<uint8_t> clearBuffer(new uint8_t[blockSize]);
-    std::unique_ptr<uint8_t> cryptBuffer(new uint8_t[blockSize]);
+    BufferPool::Buffer clearBuffer = blockPool.Acquire();
+    BufferPool::Buffer cryptBuffer = blockPool.Acquire();
     uint64_t dataBlock = (uint64_t)(offset / blockSize);
     size_t blockOffset = offset - (dataBlock * blockSize);
     uint64_t row = dataBlock / dataCount;
@@ -141,51 +1081,214 @@ namespace dfs
     size_t blockRemaining = blockSize - blockOffset;
     uint8_t * byteBuffer = (uint8_t*)buffer;
 
-    return_false_if_msg(offset >= (blockCount*dataCount*blockSize), "Error: param 'offset' out of range: %ld\n", offset);
-    return_false_if_msg(size > (blockCount*dataCount*blockSize), "Error: param 'size' out of range: %ld\n", offset);
-    return_false_if_msg((offset+size) > (blockCount*dataCount*blockSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+    size_t elided = ElideZeroRows(byteBuffer, size, offset);
+    if (elided > 0)
+    {
+      return WriteEncryptRows(byteBuffer + elided, size - elided, offset + elided);
+    }
+
+    std::unique_ptr<RowWrite> writing(new RowWrite(this, row));
+
+    return_false_if_msg(!AllocateRow(row, true, col == 0 && blockOffset == 0 && size >= dataCount * blockSize), "Error: failed to allocate row '%lx'.\n", row);
 
     return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
 
-    uint8_t iv[AES_BLOCK_SIZE];
+    bool update = PreferUpdate(col, blockOffset, size, !xts || compressor);
+    bool direct = false;
+    std::vector<CellIo> deltas;
+    std::vector<BufferPool::Buffer> deltaBuffers;
+
+    // Writes spanning several cells have their whole cells encrypted on the
+    // crypto pool ahead of the loop below, which only waits for each one in
+    // turn. The ciphertext goes to a pooled row buffer used as a ring of
+    // cells; a slot is sealed again once the row that used it is written.
+    size_t cell = 0;
+    std::vector<size_t> sealing;
+    size_t window = 0;
+    size_t sealedUntil = 0;
+    BufferPool::Buffer sealedBuffer;
+    std::unique_ptr<WorkerPool::Batch> batch;
+    const uint8_t * firstBuffer = byteBuffer;
+    size_t firstRemaining = blockRemaining;
+    size_t total = size;
+    auto sealAhead = [&](size_t until) {
+      for (until = std::min(until, sealing.size()); sealedUntil < until; ++sealedUntil)
+      {
+        size_t i = sealedUntil;
+        const uint8_t * in = (i == 0) ? firstBuffer : firstBuffer + firstRemaining + ((i - 1) * blockSize);
+        bool whole = (i == 0) ? (firstRemaining == blockSize && total >= blockSize) : size_t(in - firstBuffer) + blockSize <= total;
+        if (!whole)
+        {
+          continue;
+        }
+        uint64_t sealRow = (dataBlock + i) / dataCount;
+        uint64_t sealCol = (dataBlock + i) % dataCount;
+        uint8_t * out = sealedBuffer.get() + ((i % window) * blockSize);
+        sealing[i] = batch->Submit([this, sealRow, sealCol, in, out]() {
+          return SealCell(sealRow, sealCol, in, out);
+        });
+      }
+    };
+    if (crypto && blockOffset + size > blockSize)
+    {
+      sealedBuffer = rowPool.Acquire();
+      window = std::min(rowPool.BufferSize() / blockSize, MAX_CRYPTO_CELLS);
+      batch.reset(new WorkerPool::Batch(crypto.get()));
+      sealing.assign((blockOffset + size + blockSize - 1) / blockSize, SIZE_MAX);
+      sealAhead(window);
+    }
 
     while (true)
     {
       size_t toWrite = (size>blockRemaining)?blockRemaining:size;
-      if (toWrite < blockSize)
+
+      size_t begin = 0;
+      size_t end = 0;
+      CryptRange(blockOffset, toWrite, begin, end);
+      size_t span = end - begin;
+      bool sealed = cell < sealing.size() && sealing[cell] != SIZE_MAX;
+
+      bool stage = span == blockSize && stripe && stripe->Accepts(row, col);
+      bool delta = update && !stage;
+      if (!stage)
+      {
+        return_false_if_msg(!FlushStripe(row), "Error: failed to write [%lx,%lx].\n", row, col);
+      }
+      if (delta)
       {
-        return_false_if_msg(!__ReadCached(row, col, cryptBuffer.get(), blockSize, 0), "Error: failed to write [%lx,%lx].\n", row, col);
-        memset(iv, row, AES_BLOCK_SIZE);
-        AES_cbc_encrypt(cryptBuffer.get(), clearBuffer.get(), blockSize, &decryptKey, iv, AES_DECRYPT);
+        return_false_if_msg(!__ReadCached(row, col, cryptBuffer.get() + begin, span, begin), "Error: failed to write [%lx,%lx].\n", row, col);
       }
-      memcpy(clearBuffer.get() + blockOffset, byteBuffer, toWrite);
-      memset(iv, row, AES_BLOCK_SIZE);
-      AES_cbc_encrypt(clearBuffer.get(), cryptBuffer.get(), blockSize, &encryptKey, iv, AES_ENCRYPT);
-      return_false_if_msg(!__WriteCached(row, col, cryptBuffer.get(), blockSize, 0), "Error: failed to write [%lx,%lx].\n", row, col);
+
+      if (!sealed && toWrite < span)
+      {
+        // Sectors that are only partly written, or the whole cell with CBC or
+        // compression, are merged with their old content.
+        size_t unit = (xts && !compressor) ? BlockCipher::SECTOR_SIZE : blockSize;
+        size_t edges[2] = { begin, end - unit };
+        bool partial[2] = { blockOffset != begin, blockOffset + toWrite != end };
+        for (int i = 0; i < 2; ++i)
+        {
+          if (!partial[i] || (i == 1 && partial[0] && edges[1] == edges[0]))
+          {
+            continue;
+          }
+          if (!delta)
+          {
+            return_false_if_msg(!__ReadCached(row, col, cryptBuffer.get() + edges[i], unit, edges[i]), "Error: failed to write [%lx,%lx].\n", row, col);
+          }
+          if (compressor)
+          {
+            return_false_if(!OpenCell(row, col, cryptBuffer.get(), clearBuffer.get()));
+          }
+          else
+          {
+            return_false_if(!DecryptCell(row, col, cryptBuffer.get() + edges[i], clearBuffer.get() + edges[i], unit, edges[i]));
+          }
+        }
+      }
+
+      uint8_t * outBuffer = cryptBuffer.get();
+      if (sealed)
+      {
+        return_false_if_msg(!batch->Wait(sealing[cell]), "Error: failed to write [%lx,%lx].\n", row, col);
+        outBuffer = sealedBuffer.get() + ((cell % window) * blockSize);
+      }
+      else
+      {
+        memcpy(clearBuffer.get() + blockOffset, byteBuffer, toWrite);
+
+        if (delta)
+        {
+          deltaBuffers.emplace_back(blockPool.Acquire());
+          outBuffer = deltaBuffers.back().get();
+        }
+
+        if (compressor)
+        {
+          return_false_if(!SealCell(row, col, clearBuffer.get(), outBuffer));
+        }
+        else
+        {
+          return_false_if(!EncryptCell(row, col, clearBuffer.get() + begin, outBuffer + begin, span, begin));
+        }
+      }
+
+      bool staged = false;
+      if (stage)
+      {
+        return_false_if_msg(!stripe->Stage(row, col, outBuffer, staged), "Error: failed to write [%lx,%lx].\n", row, col);
+      }
+
+      if (!staged)
+      {
+        if (stage)
+        {
+          // The stripe was flushed in the meantime and no old copy was kept
+          update = false;
+        }
+
+        return_false_if_msg(!FlushStripe(row), "Error: failed to write [%lx,%lx].\n", row, col);
+        return_false_if_msg(!direct && !DeferParity(row), "Error: failed to write [%lx,%lx].\n", row, col);
+        return_false_if_msg(!__WriteCached(row, col, outBuffer + begin, span, begin), "Error: failed to write [%lx,%lx].\n", row, col);
+        direct = true;
+
+        if (delta)
+        {
+          deltas.push_back({col, outBuffer + begin, span, begin, false});
+          MakeDelta(coder, deltas.back(), cryptBuffer.get() + begin);
+        }
+      }
+
       byteBuffer += toWrite;
       size -= toWrite;
       blockRemaining = blockSize;
       blockOffset = 0;
+      ++cell;
 
       if (size == 0) { break; }
 
       if (++col == dataCount)
       {
-        return_false_if_msg(!GetRow(row).Encode(), "Error: row '%lx' could not be encoded.\n", row);
+        if (direct)
+        {
+          return_false_if_msg(!UpdateParity(row, deltas, update), "Error: row '%lx' could not be encoded.\n", row);
+        }
+
+        // Nothing refers to the sealed cells of the finished row any more
+        sealAhead(cell + window);
 
         col = 0;
         row++;
 
+        elided = ElideZeroRows(byteBuffer, size, row * dataCount * blockSize);
+        if (elided > 0)
+        {
+          writing.reset();
+          return WriteEncryptRows(byteBuffer + elided, size - elided, row * dataCount * blockSize + elided);
+        }
+
+        writing.reset(new RowWrite(this, row));
+
+        return_false_if_msg(!AllocateRow(row, true, size >= dataCount * blockSize), "Error: failed to allocate row '%lx'.\n", row);
+
+        update = PreferUpdate(col, 0, size, !xts || compressor);
+        direct = false;
+        deltas.clear();
+        deltaBuffers.clear();
+
         return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
       }
     }
 
-    return_false_if_msg(!GetRow(row).Encode(), "Error: row '%lx' could not be encoded.\n", row);
+    if (direct)
+    {
+      return_false_if_msg(!UpdateParity(row, deltas, update), "Error: row '%lx' could not be encoded.\n", row);
+    }
 
     return true;
   }
 
-  bool Volume::Write(const void * buffer, size_t size, size_t offset)
+  bool Volume::WriteRows(const void * buffer, size_t size, size_t offset)
   {
     if (size == 0) { return true; }
 
@@ -196,16 +1299,51 @@ namespace dfs
     size_t blockRemaining = blockSize - blockOffset;
     uint8_t * byteBuffer = (uint8_t*)buffer;
 
-    return_false_if_msg(offset >= (blockCount*dataCount*blockSize), "Error: param 'offset' out of range: %ld\n", offset);
-    return_false_if_msg(size > (blockCount*dataCount*blockSize), "Error: param 'size' out of range: %ld\n", offset);
-    return_false_if_msg((offset+size) > (blockCount*dataCount*blockSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+    size_t elided = ElideZeroRows(byteBuffer, size, offset);
+    if (elided > 0)
+    {
+      return WriteRows(byteBuffer + elided, size - elided, offset + elided);
+    }
+
+    std::unique_ptr<RowWrite> writing(new RowWrite(this, row));
+
+    return_false_if_msg(!AllocateRow(row, false, col == 0 && blockOffset == 0 && size >= dataCount * blockSize), "Error: failed to allocate row '%lx'.\n", row);
 
     return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
 
+    bool update = PreferUpdate(col, blockOffset, size, false);
+    bool direct = false;
+    std::vector<CellIo> deltas;
+    std::vector<BufferPool::Buffer> deltaBuffers;
+
     while (true)
     {
       size_t toWrite = (size>blockRemaining)?blockRemaining:size;
-      return_false_if_msg(!__WriteCached(row, col, byteBuffer, toWrite, blockOffset), "Error: failed to write [%lx,%lx].\n", row, col);
+
+      bool staged = false;
+      if (toWrite == blockSize && stripe && stripe->Accepts(row, col))
+      {
+        return_false_if_msg(!stripe->Stage(row, col, byteBuffer, staged), "Error: failed to write [%lx,%lx].\n", row, col);
+      }
+
+      if (!staged)
+      {
+        return_false_if_msg(!FlushStripe(row), "Error: failed to write [%lx,%lx].\n", row, col);
+
+        if (update)
+        {
+          deltaBuffers.emplace_back(blockPool.Acquire());
+          uint8_t * deltaBuffer = deltaBuffers.back().get();
+          return_false_if_msg(!__ReadCached(row, col, deltaBuffer, toWrite, blockOffset), "Error: failed to write [%lx,%lx].\n", row, col);
+          deltas.push_back({col, deltaBuffer, toWrite, blockOffset, false});
+          MakeDelta(coder, deltas.back(), byteBuffer);
+        }
+
+        return_false_if_msg(!direct && !DeferParity(row), "Error: failed to write [%lx,%lx].\n", row, col);
+        return_false_if_msg(!__WriteCached(row, col, byteBuffer, toWrite, blockOffset), "Error: failed to write [%lx,%lx].\n", row, col);
+        direct = true;
+      }
+
       byteBuffer += toWrite;
       size -= toWrite;
       blockRemaining = blockSize;
@@ -215,26 +1353,48 @@ namespace dfs
 
       if (++col == dataCount)
       {
-        return_false_if_msg(!GetRow(row).Encode(), "Error: row '%lx' could not be encoded.\n", row);
+        if (direct)
+        {
+          return_false_if_msg(!UpdateParity(row, deltas, update), "Error: row '%lx' could not be encoded.\n", row);
+        }
 
         col = 0;
         row++;
 
+        elided = ElideZeroRows(byteBuffer, size, row * dataCount * blockSize);
+        if (elided > 0)
+        {
+          writing.reset();
+          return WriteRows(byteBuffer + elided, size - elided, row * dataCount * blockSize + elided);
+        }
+
+        writing.reset(new RowWrite(this, row));
+
+        return_false_if_msg(!AllocateRow(row, false, size >= dataCount * blockSize), "Error: failed to allocate row '%lx'.\n", row);
+
+        update = PreferUpdate(col, 0, size, false);
+        direct = false;
+        deltas.clear();
+        deltaBuffers.clear();
+
         return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
       }
     }
 
-    return_false_if_msg(!GetRow(row).Encode(), "Error: row '%lx' could not be encoded.\n", row);
+    if (direct)
+    {
+      return_false_if_msg(!UpdateParity(row, deltas, update), "Error: row '%lx' could not be encoded.\n", row);
+    }
 
     return true;
   }
 
-  bool Volume::ReadDecrypt(void * buffer, size_t size, size_t offset)
+  bool Volume::ReadDecryptRows(void * buffer, size_t size, size_t offset)
   {
     if (size == 0) { return true; }
 
-    std::unique_ptr<uint8_t> clearBuffer(new uint8_t[blockSize]);
-    std::unique_ptr<uint8_t> cryptBuffer(new uint8_t[blockSize]);
+    BufferPool::Buffer clearBuffer = blockPool.Acquire();
+    BufferPool::Buffer cryptBuffer = blockPool.Acquire();
     uint64_t dataBlock = (uint64_t)(offset / blockSize);
     size_t blockOffset = offset - (dataBlock * blockSize);
     uint64_t row = dataBlock / dataCount;
@@ -242,21 +1402,50 @@ namespace dfs
     size_t blockRemaining = blockSize - blockOffset;
     uint8_t * byteBuffer = (uint8_t*)buffer;
 
-    return_false_if_msg(offset >= (blockCount*dataCount*blockSize), "Error: param 'offset' out of range: %ld\n", offset);
-    return_false_if_msg(size > (blockCount*dataCount*blockSize), "Error: param 'size' out of range: %ld\n", offset);
-    return_false_if_msg((offset+size) > (blockCount*dataCount*blockSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+    if (crypto && blockOffset + size > blockSize)
+    {
+      size_t chunk = MAX_CRYPTO_CELLS * blockSize - blockOffset;
+      while (size > 0)
+      {
+        size_t toRead = std::min(size, chunk);
+        return_false_if(!ReadDecryptPipelined(byteBuffer, toRead, offset));
+        byteBuffer += toRead;
+        offset += toRead;
+        size -= toRead;
+        chunk = MAX_CRYPTO_CELLS * blockSize;
+      }
+      return true;
+    }
 
-    return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+    // Rows that were never written, or were trimmed, read as zeros
+    bool allocated = IsAllocated(row);
 
-    uint8_t iv[AES_BLOCK_SIZE];
+    return_false_if_msg(!FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
+    return_false_if_msg(allocated && !GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
 
     while (true)
     {
       size_t toRead = (size>blockRemaining)?blockRemaining:size;
-      return_false_if_msg(!__ReadCached(row, col, cryptBuffer.get(), blockSize, 0), "Error: failed to read [%lx,%lx].\n", row, col);
-      memset(iv, row, AES_BLOCK_SIZE);
-      AES_cbc_encrypt(cryptBuffer.get(), clearBuffer.get(), blockSize, &decryptKey, iv, AES_DECRYPT);
-      memcpy(byteBuffer, clearBuffer.get() + blockOffset, toRead);
+      if (allocated)
+      {
+        size_t begin = 0;
+        size_t end = 0;
+        CryptRange(blockOffset, toRead, begin, end);
+        return_false_if_msg(!__ReadCached(row, col, cryptBuffer.get() + begin, end - begin, begin), "Error: failed to read [%lx,%lx].\n", row, col);
+        if (compressor)
+        {
+          return_false_if(!OpenCell(row, col, cryptBuffer.get(), clearBuffer.get()));
+        }
+        else
+        {
+          return_false_if(!DecryptCell(row, col, cryptBuffer.get() + begin, clearBuffer.get() + begin, end - begin, begin));
+        }
+        memcpy(byteBuffer, clearBuffer.get() + blockOffset, toRead);
+      }
+      else
+      {
+        memset(byteBuffer, 0, toRead);
+      }
       byteBuffer += toRead;
       size -= toRead;
       blockRemaining = blockSize;
@@ -268,13 +1457,114 @@ namespace dfs
       {
         col = 0;
         row++;
-        return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+        allocated = IsAllocated(row);
+        return_false_if_msg(!FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
+        return_false_if_msg(allocated && !GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
       }
     }
     return true;
   }
 
-  bool Volume::Read(void * buffer, size_t size, size_t offset)
+  // Reads the cells of each row in one batch and decrypts them on the crypto
+  // pool while the next row is being read. The ciphertext goes to a pooled
+  // row buffer used as a ring of cells, so a slot is only read into again
+  // once its previous cell has been decrypted.
+  bool Volume::ReadDecryptPipelined(uint8_t * buffer, size_t size, size_t offset)
+  {
+    uint64_t dataBlock = (uint64_t)(offset / blockSize);
+    size_t blockOffset = offset - (dataBlock * blockSize);
+
+    BufferPool::Buffer cryptBuffer = rowPool.Acquire();
+    size_t window = std::min(rowPool.BufferSize() / blockSize, MAX_CRYPTO_CELLS);
+    std::vector<size_t> decrypting(window, SIZE_MAX);
+    WorkerPool::Batch batch(crypto.get());
+
+    size_t cell = 0;
+    while (size > 0)
+    {
+      uint64_t row = (dataBlock + cell) / dataCount;
+      uint64_t col = (dataBlock + cell) % dataCount;
+
+      bool allocated = IsAllocated(row);
+
+      return_false_if_msg(!FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
+      return_false_if_msg(allocated && !GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+
+      std::vector<CellIo> reads;
+      std::vector<std::pair<uint8_t *, size_t>> targets;
+      std::vector<size_t> slots;
+      uint8_t * out = buffer;
+      for (; col < dataCount && size > 0; ++col, ++cell)
+      {
+        size_t toRead = std::min(size, blockSize - blockOffset);
+        if (!allocated)
+        {
+          memset(buffer, 0, toRead);
+          buffer += toRead;
+          size -= toRead;
+          blockOffset = 0;
+          continue;
+        }
+
+        size_t begin = 0;
+        size_t end = 0;
+        CryptRange(blockOffset, toRead, begin, end);
+
+        size_t slot = cell % window;
+        if (decrypting[slot] != SIZE_MAX)
+        {
+          return_false_if(!batch.Wait(decrypting[slot]));
+          decrypting[slot] = SIZE_MAX;
+        }
+
+        // Each cell is decrypted in place and then copied out from 'blockOffset'
+        uint8_t * cipherText = cryptBuffer.get() + (slot * blockSize);
+        slots.push_back(slot);
+        reads.push_back({col, cipherText + begin, end - begin, begin, false});
+        targets.emplace_back(cipherText + blockOffset, toRead);
+
+        buffer += toRead;
+        size -= toRead;
+        blockOffset = 0;
+      }
+
+      if (!reads.empty() && !__ReadCached(row, reads))
+      {
+        // Retry the failed cells one by one, which can hedge or decode them
+        for (auto & read : reads)
+        {
+          if (!read.success)
+          {
+            return_false_if_msg(!__ReadCached(row, read.column, read.buffer, read.size, read.offset), "Error: failed to read [%lx,%lx].\n", row, read.column);
+          }
+        }
+      }
+
+      for (size_t i = 0; i < reads.size(); ++i)
+      {
+        CellIo read = reads[i];
+        auto target = targets[i];
+        decrypting[slots[i]] = batch.Submit([this, row, read, target, out]() {
+          uint8_t * cipherText = static_cast<uint8_t *>(read.buffer);
+          if (compressor)
+          {
+            return_false_if(!OpenCell(row, read.column, cipherText, cipherText));
+          }
+          else
+          {
+            return_false_if(!DecryptCell(row, read.column, cipherText, cipherText, read.size, read.offset));
+          }
+          memcpy(out, target.first, target.second);
+          return true;
+        });
+        out += target.second;
+      }
+    }
+
+    return batch.Wait();
+  }
+
+  bool Volume::ReadRows(void * buffer, size_t size, size_t offset)
   {
     if (size == 0) { return true; }
 
@@ -285,16 +1575,23 @@ namespace dfs
     size_t blockRemaining = blockSize - blockOffset;
     uint8_t * byteBuffer = (uint8_t*)buffer;
 
-    return_false_if_msg(offset >= (blockCount*dataCount*blockSize), "Error: param 'offset' out of range: %ld\n", offset);
-    return_false_if_msg(size > (blockCount*dataCount*blockSize), "Error: param 'size' out of range: %ld\n", offset);
-    return_false_if_msg((offset+size) > (blockCount*dataCount*blockSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+    // Rows that were never written, or were trimmed, read as zeros
+    bool allocated = IsAllocated(row);
 
-    return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+    return_false_if_msg(!FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
+    return_false_if_msg(allocated && !GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
 
     while (true)
     {
       size_t toRead = (size>blockRemaining)?blockRemaining:size;
-      return_false_if_msg(!__ReadCached(row, col, byteBuffer, toRead, blockOffset), "Error: failed to read [%lx,%lx].\n", row, col);
+      if (allocated)
+      {
+        return_false_if_msg(!__ReadCached(row, col, byteBuffer, toRead, blockOffset), "Error: failed to read [%lx,%lx].\n", row, col);
+      }
+      else
+      {
+        memset(byteBuffer, 0, toRead);
+      }
       byteBuffer += toRead;
       size -= toRead;
       blockRemaining = blockSize;
@@ -305,7 +1602,9 @@ namespace dfs
         col = 0;
         row++;
 
-        return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+        allocated = IsAllocated(row);
+        return_false_if_msg(!FlushStripe(row), "Error: failed to flush row '%lx'.\n", row);
+        return_false_if_msg(allocated && !GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
       }
     }
     return true;
@@ -329,7 +1628,7 @@ namespace dfs
     return_false_if_msg(column >= partitions.size(), "Error: param 'column' is out of range: %ld >= %ld\n", column, partitions.size());
     Partition * partition = partitions[column];
     return_false_if_msg(partition == NULL, "Error: partition '%ld' is not set\n", column);
-    return partition->VerifyBlock(row);
+    return partition->VerifyBlock(row) && IsRebuilt(row, column);
   }
 
   bool Volume::__WriteCell(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
@@ -337,6 +1636,7 @@ namespace dfs
     return_false_if_msg(column >= partitions.size(), "Error: param 'column' is out of range: %ld >= %ld\n", column, partitions.size());
     Partition * partition = partitions[column];
     return_false_if_msg(partition == NULL, "Error: partition '%ld' is not set\n", column);
+    return_false_if(!FlushStripe(row));
     if (column < dataCount)
     {
       return_false_if(!GetRow(row).Verify());
@@ -354,6 +1654,7 @@ namespace dfs
     return_false_if_msg(column >= partitions.size(), "Error: param 'column' is out of range: %ld >= %ld\n", column, partitions.size());
     Partition * partition = partitions[column];
     return_false_if_msg(partition == NULL, "Error: partition '%ld' is not set\n", column);
+    return_false_if(!FlushStripe(row));
     if (!__ReadCached(row, column, buffer, size, offset))
     {
       return_false_if(!GetRow(row).Verify());
@@ -387,12 +1688,267 @@ namespace dfs
 
   bool Volume::__ReadDirect(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset)
   {
+    if (hedgePercentile > 0 && column < dataCount && !IsWriting(row) && IsRebuilt(row))
+    {
+      return ReadHedged(row, column, buffer, size, offset);
+    }
+
     return partitions[column]->ReadBlock(row, buffer, size, offset);
   }
 
+
+  bool Volume::ReadHedged(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    auto primary = partitions[column]->BeginReadBlock(row, size, offset);
+
+    uint32_t delay = 0;
+    bool history = readLatency.Percentile(hedgePercentile, delay);
+
+    // A partition already known to be slower than that isn't waited for
+    auto score = partitions[column]->Health().GetScore();
+    if (history && (score.latency > delay || score.errorRate > 0.5))
+    {
+      delay = 0;
+    }
+
+    if (primary && (!history || primary->Wait(std::max<uint32_t>(delay, 1))))
+    {
+      // Not enough history to hedge on yet, or the cell answered in time
+      bool success = partitions[column]->EndReadBlock(primary, buffer, size);
+      if (success)
+      {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        readLatency.Record(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+      }
+      return success;
+    }
+
+    // The cell is slow: read every other cell of the row as well and take
+    // whichever completes first, the cell itself or any k of the others.
+    struct Hedge
+    {
+      std::mutex mutex;
+      std::condition_variable cond;
+    };
+
+    auto hedge = std::make_shared<Hedge>();
+
+    uint64_t columns = partitions.size();
+    std::vector<bdfs::AsyncResultPtr<std::string>> results(columns);
+    results[column] = primary;
+
+    for (uint64_t i = 0; i < columns; ++i)
+    {
+      if (i != column && partitions[i] != NULL)
+      {
+        results[i] = partitions[i]->BeginReadBlock(row, blockSize, 0);
+      }
+    }
+
+    for (auto & result : results)
+    {
+      if (result)
+      {
+        result->OnComplete([hedge]()
+        {
+          std::unique_lock<std::mutex> lock(hedge->mutex);
+          hedge->cond.notify_all();
+        });
+      }
+    }
+
+    auto ready = [&](uint64_t i)
+    {
+      return results[i] && results[i]->IsCompleted() && results[i]->GetResult().size() == blockSize;
+    };
+
+    // With local groups the rest of the group is enough to rebuild the cell
+    auto groupReady = [&]()
+    {
+      if (localCount == 0)
+      {
+        return false;
+      }
+
+      uint64_t group = LocalGroupOf(column);
+      for (uint64_t i = LocalGroupBegin(group); i < LocalGroupBegin(group + 1); ++i)
+      {
+        if (i != column && !ready(i))
+        {
+          return false;
+        }
+      }
+
+      return ready(LocalColumn(group));
+    };
+
+    auto deadline = start + std::chrono::milliseconds(partitions[column]->GetTimeout());
+
+    uint64_t available = 0;
+    bool local = false;
+
+    {
+      std::unique_lock<std::mutex> lock(hedge->mutex);
+
+      while (true)
+      {
+        if (primary && primary->IsCompleted() && primary->GetResult().size() == size)
+        {
+          break;
+        }
+
+        available = 0;
+        uint64_t pending = 0;
+        for (uint64_t i = 0; i < columns; ++i)
+        {
+          if (i != column)
+          {
+            available += (i < dataCount + codeCount && ready(i)) ? 1 : 0;
+            pending += (results[i] && !results[i]->IsCompleted()) ? 1 : 0;
+          }
+        }
+
+        local = groupReady();
+
+        if (local || available >= dataCount || (pending == 0 && (!primary || primary->IsCompleted())))
+        {
+          break;
+        }
+
+        if (hedge->cond.wait_until(lock, deadline) == std::cv_status::timeout)
+        {
+          break;
+        }
+      }
+    }
+
+    if (primary && primary->IsCompleted() && partitions[column]->EndReadBlock(primary, buffer, size))
+    {
+      return true;
+    }
+
+    if (local)
+    {
+      uint64_t group = LocalGroupOf(column);
+      std::string & cell = results[LocalColumn(group)]->GetResult();
+      uint8_t * out = reinterpret_cast<uint8_t *>(&cell[0]);
+
+      for (uint64_t i = LocalGroupBegin(group); i < LocalGroupBegin(group + 1); ++i)
+      {
+        if (i != column)
+        {
+          coder->Add(out, reinterpret_cast<const uint8_t *>(&results[i]->GetResult()[0]), blockSize);
+        }
+      }
+
+      memcpy(buffer, out + offset, size);
+      return true;
+    }
+
+    return_false_if_msg(available < dataCount, "Error: failed to read [%lx,%lx].\n", row, column);
+
+    // Prefer data cells so that as little as possible has to be decoded
+    ErasureBlock blocks[256] = {};
+    uint64_t count = 0;
+
+    for (uint64_t i = 0; i < dataCount + codeCount && count < dataCount; ++i)
+    {
+      if (i != column && ready(i))
+      {
+        blocks[count].buffer = &results[i]->GetResult()[0];
+        blocks[count].index = i;
+        ++count;
+      }
+    }
+
+    return_false_if_msg(!coder->Decode(dataCount, codeCount, blocks, blockSize), "Error: failed to decode row '%lx'.\n", row);
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+      if (blocks[i].index == column)
+      {
+        memcpy(buffer, static_cast<uint8_t *>(blocks[i].buffer) + offset, size);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
   bool Volume::__WriteDirect(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
   {
-    return partitions[column]->WriteBlock(row, buffer, size, offset);
+    RowWrite writing(this, row);
+    return partitions[column]->WriteBlock(row, buffer, size, offset, StoredSize(buffer, size, offset));
+  }
+
+
+  bool Volume::__ReadCached(uint64_t row, std::vector<CellIo> & cells)
+  {
+    if (cache)
+    {
+      return cache->Read(row, cells);
+    }
+
+    return __ReadDirect(row, cells);
+  }
+
+
+  bool Volume::__WriteCached(uint64_t row, std::vector<CellIo> & cells)
+  {
+    if (cache)
+    {
+      return cache->Write(row, cells);
+    }
+
+    return __WriteDirect(row, cells);
+  }
+
+
+  bool Volume::__ReadDirect(uint64_t row, std::vector<CellIo> & cells)
+  {
+    std::vector<bdfs::AsyncResultPtr<std::string>> results;
+    results.reserve(cells.size());
+
+    for (auto & cell : cells)
+    {
+      results.emplace_back(partitions[cell.column]->BeginReadBlock(row, cell.size, cell.offset));
+    }
+
+    bool success = true;
+
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+      cells[i].success = partitions[cells[i].column]->EndReadBlock(results[i], cells[i].buffer, cells[i].size);
+      success = success && cells[i].success;
+    }
+
+    return success;
+  }
+
+
+  bool Volume::__WriteDirect(uint64_t row, std::vector<CellIo> & cells)
+  {
+    RowWrite writing(this, row);
+
+    std::vector<bdfs::AsyncResultPtr<ssize_t>> results;
+    results.reserve(cells.size());
+
+    for (auto & cell : cells)
+    {
+      results.emplace_back(partitions[cell.column]->BeginWriteBlock(row, cell.buffer, cell.size, cell.offset, StoredSize(cell.buffer, cell.size, cell.offset)));
+    }
+
+    bool success = true;
+
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+      cells[i].success = partitions[cells[i].column]->EndWriteBlock(results[i], cells[i].size);
+      success = success && cells[i].success;
+    }
+
+    return success;
   }
 
   /*
@@ -26,16 +26,47 @@
 #include <stddef.h>
 
 #include "Partition.h"
+#include "LatencyWindow.h"
+#include "ErasureCoder.h"
+#include "BufferPool.h"
+#include "RowLocks.h"
 
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <map>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <stdio.h>
 
 #include <openssl/aes.h>
 
+class BitSet;
+
 namespace dfs
 {
   class Cache;
+  class StripeBuffer;
+  class Rebuilder;
+  class Scrubber;
+  class ReadAhead;
+  class BlockCipher;
+  class WorkerPool;
+  class Compressor;
+  class LazyParity;
+
+  // One cell of a row-wide batch request. For writes the buffer is only read.
+  struct CellIo
+  {
+    uint64_t column;
+    void * buffer;
+    size_t size;
+    size_t offset;
+    bool success;
+  };
 
   class Volume
   {
@@ -63,6 +94,10 @@ namespace dfs
       bool Verify();
       bool Decode();
       bool Encode();
+      bool Encode(std::vector<CellIo> & cells);
+      bool Update(const std::vector<CellIo> & deltas);
+    private:
+      bool DecodeLocal(const std::vector<bool> & valid);
     };
 
     class Column
@@ -76,9 +111,28 @@ namespace dfs
       Cell GetCell(uint64_t row);
     };
 
+    // Marks a row as being written while in scope. Its cells can disagree
+    // with its parity until the write completes, so they are not used to
+    // reconstruct hedged reads or rebuilds. Waits while the row is claimed
+    // by a rebuild.
+    class RowWrite
+    {
+    private:
+      Volume * volume;
+      uint64_t row;
+    public:
+      RowWrite(Volume * volume, uint64_t row);
+      ~RowWrite();
+    };
+
     friend class Cell;
     friend class Row;
     friend class Column;
+    friend class Rebuilder;
+    friend class Scrubber;
+    friend class ReadAhead;
+    friend class LazyParity;
+    friend class WriteBack;
 
   private:
     uint8_t * zeroBuffer;
@@ -86,36 +140,208 @@ namespace dfs
     uint64_t blockCount;
     uint64_t dataCount;
     uint64_t codeCount;
+    uint64_t localCount;
     size_t blockSize;
     std::vector<Partition*> partitions;
     AES_KEY encryptKey;
     AES_KEY decryptKey;
+    std::unique_ptr<BlockCipher> cipher;
+    bool xts = false;
+    std::unique_ptr<WorkerPool> crypto;
+    const Compressor * compressor = nullptr;
+    std::unique_ptr<WorkerPool> workers;
+    RowLocks rowLocks;
+    const ErasureCoder * coder;
+    BufferPool blockPool;
+    BufferPool rowPool;
 
     std::unique_ptr<Cache> cache;
+    std::unique_ptr<StripeBuffer> stripe;
+    std::unique_ptr<Scrubber> scrubber;
+    std::unique_ptr<ReadAhead> readAhead;
+    std::unique_ptr<LazyParity> lazyParity;
+
+    double hedgePercentile = 0;
+    LatencyWindow readLatency;
+    std::mutex writingMutex;
+    std::condition_variable writingCond;
+    std::multiset<uint64_t> writingRows;
+    std::set<uint64_t> claimedRows;
+
+    std::string rebuildPath;
+    size_t rebuildWorkers = 0;
+    size_t rebuildBatch = 0;
+    uint32_t rebuildRate = 0;
+    std::mutex rebuildMutex;
+    std::map<uint64_t, std::unique_ptr<Rebuilder>> rebuilders;
+    std::atomic<size_t> rebuildActive;
+
+    std::atomic<int64_t> foregroundTime;
+
+    // Rows that may hold data. A clear bit means the row reads as zeros
+    // whatever its cells contain.
+    std::unique_ptr<BitSet> allocated;
+    FILE * allocationFile = nullptr;
+    std::mutex allocationMutex;
+    std::mutex allocateMutex;
+
+    bool PreferUpdate(uint64_t col, size_t blockOffset, size_t size, bool partialIsRead);
+    bool UpdateParity(uint64_t row, const std::vector<CellIo> & deltas, bool update);
+    bool DeferParity(uint64_t row);
+    bool FlushStripe(uint64_t row);
+    bool IsWriting(uint64_t row);
+    void MarkForeground();
+    bool ClaimRow(uint64_t row);
+    void ReleaseRow(uint64_t row);
+    bool IsClaimed(uint64_t row);
+    void BeginWriting(uint64_t row);
+    void EndWriting(uint64_t row);
+    void StartRebuild(uint64_t column, bool resume);
+    bool IsRebuilt(uint64_t row);
+    bool IsRebuilt(uint64_t row, uint64_t column);
+    void MarkRebuilt(uint64_t row);
+    bool IsAllocated(uint64_t row);
+    bool SetAllocated(uint64_t row, bool value);
+    bool AllocateRow(uint64_t row, bool encrypted, bool overwritten);
+    void TrimRow(uint64_t row);
+    bool DeallocateRow(uint64_t row);
+    size_t ElideZeroRows(const uint8_t * buffer, size_t size, size_t offset);
+    bool ReadHedged(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
+    void CryptRange(size_t blockOffset, size_t size, size_t & begin, size_t & end);
+    bool EncryptCell(uint64_t row, uint64_t column, const uint8_t * in, uint8_t * out, size_t size, size_t offset);
+    bool DecryptCell(uint64_t row, uint64_t column, const uint8_t * in, uint8_t * out, size_t size, size_t offset);
+    bool SealCell(uint64_t row, uint64_t column, const uint8_t * clear, uint8_t * stored);
+    bool OpenCell(uint64_t row, uint64_t column, const uint8_t * stored, uint8_t * clear);
+    size_t StoredSize(const void * stored, size_t size, size_t offset) const;
+    bool ReadDecryptPipelined(uint8_t * buffer, size_t size, size_t offset);
+    bool WholeRow(size_t size, size_t offset) const;
+    bool Serve(uint8_t * buffer, size_t size, size_t offset, bool write, const std::function<bool(uint8_t *, size_t, size_t)> & io);
+    bool WriteRow(const uint8_t * buffer, uint64_t row, bool encrypted);
+    bool WriteEncryptRows(const void * buffer, size_t size, size_t offset);
+    bool ReadDecryptRows(void * buffer, size_t size, size_t offset);
+    bool WriteRows(const void * buffer, size_t size, size_t offset);
+    bool ReadRows(void * buffer, size_t size, size_t offset);
 
   public:
-    Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password);
+    // 'localCount' > 0 makes it a locally repairable code: the data columns
+    // are split into that many groups, each with an xor parity column after
+    // the 'codeCount' global parity columns.
+    Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password, uint64_t localCount = 0);
     ~Volume();
 
     bool SetPartition(uint64_t index, Partition * partition);
 
+    // How WriteEncrypt and ReadDecrypt lay out data, kept as "cryptoVersion"
+    // in volume.conf. CRYPTO_CBC chains each whole cell with AES-128-CBC,
+    // CRYPTO_XTS encrypts each 4K sector on its own, see BlockCipher.
+    enum CryptoVersion : uint32_t
+    {
+      CRYPTO_CBC = 0,
+      CRYPTO_XTS = 1
+    };
+
+    bool SetCryptoVersion(uint32_t version);
+
+    // Compresses the cells of WriteEncrypt with the named codec (see
+    // Compressor::Get), kept as "compression" in volume.conf. Cells are then
+    // always read and written whole. Once set it has to stay set, since
+    // ReadDecrypt only recognizes compressed cells while it is.
+    bool SetCompression(const std::string & name);
+
+    // Selects the erasure coding implementation by name, see ErasureCoder::Get.
+    bool SetErasureCoder(const std::string & name);
+
     void EnableCache(std::unique_ptr<Cache> cache);
 
+    Cache * GetCache() { return cache.get(); }
+
+    void EnableStripe(std::unique_ptr<StripeBuffer> stripe);
+
+    void EnableScrub(std::unique_ptr<Scrubber> scrubber);
+
+    // WriteEncrypt and ReadDecrypt spanning several cells hand the cells to
+    // the pool and overlap their encryption with the partition I/O.
+    void EnableCryptoPool(std::unique_ptr<WorkerPool> crypto);
+
+    // Requests spanning several rows are served by the pool a row at a time.
+    // Requests to different rows run concurrently either way; only those
+    // that overlap a write wait for it.
+    void EnableWorkers(std::unique_ptr<WorkerPool> workers);
+
+    Scrubber * GetScrubber() { return scrubber.get(); }
+
+    // Only takes effect with a cache, which is where rows are read ahead to.
+    void EnableReadAhead(std::unique_ptr<ReadAhead> readAhead);
+
+    ReadAhead * GetReadAhead() { return readAhead.get(); }
+
+    // Data cells that take longer than the given percentile of recent reads
+    // are raced against a reconstruction from the other cells of the row.
+    // 0 disables hedging.
+    void EnableHedging(double percentile);
+
+    // Replaced partitions are rebuilt in the background by 'workers' threads
+    // taking 'batch' rows at a time, at most 'rowsPerSecond' rows per second
+    // (0 for no limit). Progress is checkpointed under 'path' and rebuilds
+    // found there are resumed.
+    void EnableRebuild(const std::string & path, size_t workers, size_t batch, uint32_t rowsPerSecond);
+
+    // Partial row writes are acknowledged once their data cells are stored,
+    // and their parity is encoded by 'workers' threads in the background,
+    // see LazyParity. The rows waiting for it are journaled at 'path'.
+    bool EnableLazyParity(const std::string & path, size_t workers);
+
+    LazyParity * GetLazyParity() { return lazyParity.get(); }
+
+    // Write barrier: every write that completed before the call is on the
+    // partitions once it returns.
+    bool Flush();
+
+    // Loads the allocation map kept at 'path'. Without one every row is
+    // taken to hold data and a map saying so is created.
+    bool EnableAllocationMap(const std::string & path);
+
+    // Whole rows within the range read as zeros afterwards, and their cells
+    // are released on the hosts. Partly covered rows are left alone.
+    bool Trim(size_t offset, size_t size);
+
     uint32_t GetTimeout() const;
 
+    // Scoreboard of the partition in 'column', nullptr while it isn't set.
+    // Degraded reads favour the parity of the healthiest partitions, and
+    // reads from a partition known to be slow are hedged right away.
+    const PartitionHealth * GetHealth(uint64_t column) const;
+
+    // Host of the partition in 'column', empty while it isn't set.
+    std::string GetHost(uint64_t column) const;
+
+    // Milliseconds since the last read or write through the public interface.
+    uint64_t IdleTime();
+
     const uint64_t Rows() { return blockCount; }
     const uint64_t Columns() { return partitions.size(); }
     const uint64_t DataCount() { return dataCount; }
     const uint64_t CodeCount() { return codeCount; }
+    const uint64_t LocalCount() { return localCount; }
     const uint64_t BlockCount() { return blockCount; }
     const size_t BlockSize() { return blockSize; }
 
     const size_t DataSize() { return dataCount * blockCount * blockSize; }
-    const size_t CodeSize() { return codeCount * blockCount * blockSize; }
-    const size_t TotalSize() { return (dataCount + codeCount) * blockCount * blockSize; }
+    const size_t CodeSize() { return (codeCount + localCount) * blockCount * blockSize; }
+    const size_t TotalSize() { return (dataCount + codeCount + localCount) * blockCount * blockSize; }
+
+    // Local group of data column 'column', the first data column of group
+    // 'group' and the column of its parity.
+    const uint64_t LocalGroupOf(uint64_t column) { return column * localCount / dataCount; }
+    const uint64_t LocalGroupBegin(uint64_t group) { return (group * dataCount + localCount - 1) / localCount; }
+    const uint64_t LocalColumn(uint64_t group) { return dataCount + codeCount + group; }
 
     const uint8_t * GetZeroBuffer();
 
+    // Scratch buffers of one cell and of a whole row.
+    BufferPool & BlockPool() { return blockPool; }
+    BufferPool & RowPool() { return rowPool; }
+
     Volume::Column GetColumn(uint64_t column);
     Volume::Row GetRow(uint64_t row);
     Volume::Cell GetCell(uint64_t row, uint64_t column);
@@ -137,5 +363,13 @@ namespace dfs
 
     bool __ReadDirect(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
     bool __WriteDirect(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
+
+    // Batch variants: all cells of the row are requested at once and then
+    // waited on together, so a row costs one round trip instead of one per cell.
+    bool __ReadCached(uint64_t row, std::vector<CellIo> & cells);
+    bool __WriteCached(uint64_t row, std::vector<CellIo> & cells);
+
+    bool __ReadDirect(uint64_t row, std::vector<CellIo> & cells);
+    bool __WriteDirect(uint64_t row, std::vector<CellIo> & cells);
   };
 }
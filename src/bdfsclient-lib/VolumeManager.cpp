@@ -39,6 +39,7 @@
 #include "BdKademlia.h"
 #include "BdPartitionFolder.h"
 #include "Buffer.h"
+#include "BitSet.h"
 #include "ContractRepository.h"
 
 namespace dfs
@@ -88,13 +89,14 @@ namespace dfs
     uint64_t blockCount = json["blockCount"].asUInt();
     uint64_t dataBlocks = json["dataBlocks"].asUInt();
     uint64_t codeBlocks = json["codeBlocks"].asUInt();
+    uint64_t localGroups = json["localGroups"].isIntegral() ? json["localGroups"].asUInt() : 0;
 
-    if (json["partitions"].size() < dataBlocks + codeBlocks)
+    if (localGroups > dataBlocks || json["partitions"].size() < dataBlocks + codeBlocks + localGroups)
     {
       return nullptr;
     }
 
-    auto volume = std::make_unique<Volume>(name.c_str(), dataBlocks, codeBlocks, blockCount, blockSize, "HelloWorld");
+    auto volume = std::make_unique<Volume>(name.c_str(), dataBlocks, codeBlocks, blockCount, blockSize, "HelloWorld", localGroups);
 
     for (size_t i = 0; i < json["partitions"].size(); ++i)
     {
@@ -120,6 +122,41 @@ namespace dfs
       volume->SetPartition(i, new Partition(partition, blockCount, blockSize));
     }
 
+    if (json["erasureCoder"].isString() && !volume->SetErasureCoder(json["erasureCoder"].asString()))
+    {
+      return nullptr;
+    }
+
+    // Volumes created before the version was recorded use CBC.
+    uint32_t cryptoVersion = json["cryptoVersion"].isIntegral() ? json["cryptoVersion"].asUInt() : Volume::CRYPTO_CBC;
+    if (!volume->SetCryptoVersion(cryptoVersion))
+    {
+      return nullptr;
+    }
+
+    if (json["compression"].isString() && !volume->SetCompression(json["compression"].asString()))
+    {
+      return nullptr;
+    }
+
+    if (json["hedgePercentile"].isNumeric())
+    {
+      volume->EnableHedging(json["hedgePercentile"].asDouble());
+    }
+
+    // Kept next to volume.conf, see CreateVolume
+    if (!volume->EnableAllocationMap(path.substr(0, path.rfind('/') + 1) + "allocation"))
+    {
+      return nullptr;
+    }
+
+    // Number of threads encoding deferred parity, 0 to encode it with the write
+    if (json["lazyParity"].isIntegral() && json["lazyParity"].asUInt() > 0 &&
+        !volume->EnableLazyParity(path.substr(0, path.rfind('/') + 1) + "parity", json["lazyParity"].asUInt()))
+    {
+      return nullptr;
+    }
+
     return volume;
   }
 
@@ -162,11 +199,11 @@ namespace dfs
   }
 
 
-  bool VolumeManager::CreateVolume(const std::string & volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks)
+  bool VolumeManager::CreateVolume(const std::string & volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks, const uint16_t localGroups)
   {
     size_t blockSize = 64*1024;
     auto providerSize = size / dataBlocks;
-    auto providerCount = dataBlocks + codeBlocks;
+    auto providerCount = dataBlocks + codeBlocks + localGroups;
     std::unordered_set<std::string> providersUsed;
     Json::Value partitionsArray;
 
@@ -287,6 +324,11 @@ namespace dfs
     volume["blockCount"] = Json::Value::UInt(providerSize / blockSize);
     volume["dataBlocks"] = Json::Value::UInt(dataBlocks);
     volume["codeBlocks"] = Json::Value::UInt(codeBlocks);
+    volume["cryptoVersion"] = Json::Value::UInt(Volume::CRYPTO_XTS);
+    if (localGroups > 0)
+    {
+      volume["localGroups"] = Json::Value::UInt(localGroups);
+    }
     volume["partitions"] = partitionsArray;
 
     std::string result = volume.toStyledString();
@@ -318,6 +360,17 @@ namespace dfs
 
     fclose(file);
 
+    // Nothing has been written to the new partitions, so every row starts
+    // out unallocated and reads as zeros without going to the hosts.
+    BitSet allocation(providerSize / blockSize);
+    std::string allocationPath = path.substr(0, path.rfind('/') + 1) + "allocation";
+    file = fopen(allocationPath.c_str(), "w");
+    if (file)
+    {
+      allocation.WriteTo(file);
+      fclose(file);
+    }
+
     printf("Config file: %s\n",path.c_str());
 
     return (partitionsArray.size() == providerCount);
@@ -341,6 +394,8 @@ namespace dfs
 
     std::string path = !configPath.empty() ? configPath : "/etc/drive/" + name + "/volume.conf";
     unlink(path.c_str());
+    unlink((path.substr(0, path.rfind('/') + 1) + "allocation").c_str());
+    unlink((path.substr(0, path.rfind('/') + 1) + "parity").c_str());
 
     return true;
   }
@@ -33,7 +33,7 @@ namespace dfs
   public:
     static std::unique_ptr<Volume> LoadVolume(const std::string &name, const std::string &configPath = "");
 
-    static bool CreateVolume(const std::string &volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks);
+    static bool CreateVolume(const std::string &volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks, const uint16_t localGroups = 0);
 
     static bool DeleteVolume(const std::string &name, const std::string &path);
 
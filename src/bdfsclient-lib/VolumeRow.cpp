@@ -21,16 +21,43 @@
 */
 
 #include "Volume.h"
-#include "cm256.h"
-#include "gf256.h"
+#include "ErasureCoder.h"
+#include "LazyParity.h"
 #include "Util.h"
 
 #include <memory.h>
 #include <memory>
+#include <algorithm>
 #include <openssl/sha.h>
 
 namespace dfs
 {
+  // Computes the xor parity of every local group into 'local', one cell per
+  // group. 'blocks' holds the data cells in column order.
+  static void EncodeLocal(Volume * volume, const ErasureCoder * coder, const ErasureBlock * blocks, uint8_t * local)
+  {
+    size_t blockSize = volume->BlockSize();
+
+    for (uint64_t g = 0; g < volume->LocalCount(); ++g)
+    {
+      uint8_t * parity = local + (g * blockSize);
+      uint64_t begin = volume->LocalGroupBegin(g);
+      uint64_t end = volume->LocalGroupBegin(g + 1);
+
+      for (uint64_t i = begin; i < end; ++i)
+      {
+        if (i == begin)
+        {
+          memcpy(parity, blocks[i].buffer, blockSize);
+        }
+        else
+        {
+          coder->Add(parity, static_cast<const uint8_t *>(blocks[i].buffer), blockSize);
+        }
+      }
+    }
+  }
+
   Volume::Row::Row(Volume * volume, uint64_t row) :
     volume(volume),
     row(row)
@@ -43,7 +70,7 @@ namespace dfs
     {
       Partition * p = volume->partitions[i];
       return_false_if_msg(p == NULL, "Error: partition '%ld' is not set.\n", i);
-      if (!p->VerifyBlock(row))
+      if (!p->VerifyBlock(row) || !volume->IsRebuilt(row, i))
       {
         return_false_if(!Decode());
       }
@@ -56,28 +83,46 @@ namespace dfs
     size_t blockSize = volume->BlockSize();
     uint64_t codeCount = volume->CodeCount();
     uint64_t dataCount = volume->DataCount();
+    uint64_t localCount = volume->LocalCount();
+
+    std::vector<bool> valid(volume->Columns());
+    for (uint64_t i = 0; i < volume->Columns(); ++i)
+    {
+      valid[i] = volume->__VerifyCell(row, i);
+    }
+
+    // Parity that is still to be encoded would decode into garbage
+    if (volume->lazyParity && volume->lazyParity->IsDirty(row))
+    {
+      for (uint64_t i = 0; i < dataCount; ++i)
+      {
+        return_false_if_msg(!valid[i], "Error: row '%lx' lost column '%lx' before its parity was encoded.\n", row, i);
+      }
+    }
 
-    cm256_encoder_params params;
-    params.BlockBytes = blockSize;
-    params.OriginalCount = dataCount;
-    params.RecoveryCount = codeCount;
+    if (localCount > 0 && DecodeLocal(valid))
+    {
+      volume->MarkRebuilt(row);
+      return true;
+    }
 
     size_t dataSize = dataCount * blockSize;
-    std::unique_ptr<uint8_t> dataBuffer(new uint8_t[dataSize]);
+    BufferPool::Buffer dataBuffer = volume->rowPool.Acquire(dataSize);
     memset(dataBuffer.get(), 0, dataSize);
 
     std::vector<uint64_t> missingBlocks;
+    std::vector<CellIo> cells;
 
-    cm256_block blocks[256] = {0};
+    ErasureBlock blocks[256] = {};
 
     for (int i = 0; i < dataCount; i++)
     {
       uint8_t * dataCell = dataBuffer.get() + (i * blockSize);
-      blocks[i].Block = dataCell;
-      if (volume->__VerifyCell(row, i))
+      blocks[i].buffer = dataCell;
+      if (valid[i])
       {
-        return_false_if(!volume->__ReadCached(row, i, dataCell, blockSize, 0));
-        blocks[i].Index = i;
+        cells.push_back({(uint64_t)i, dataCell, blockSize, 0, false});
+        blocks[i].index = i;
       }
       else
       {
@@ -85,80 +130,310 @@ namespace dfs
       }
     }
 
+    // Missing cells are made up from the parity of the healthiest partitions
+    std::vector<uint64_t> parity;
+    for (uint64_t i = dataCount; i < dataCount + codeCount; i++)
+    {
+      if (valid[i])
+      {
+        parity.push_back(i);
+      }
+    }
+
+    std::stable_sort(parity.begin(), parity.end(), [this](uint64_t a, uint64_t b)
+    {
+      return volume->partitions[a]->Health().Cost() < volume->partitions[b]->Health().Cost();
+    });
+
+    size_t mi = 0;
+    for (size_t i = 0; i < parity.size() && mi < missingBlocks.size(); i++)
+    {
+      size_t oi = missingBlocks[mi++];
+      cells.push_back({parity[i], blocks[oi].buffer, blockSize, 0, false});
+      blocks[oi].index = parity[i];
+    }
+
+    return_false_if_msg(mi < missingBlocks.size(), "Error: not enough cells to decode row '%lx'.\n", row);
+
+    return_false_if(!volume->__ReadCached(row, cells));
+
+    cells.clear();
+
     if (missingBlocks.size() > 0)
     {
-      size_t mi = 0;
-      for (int i = 0; i < codeCount; i++)
+      return_false_if_msg(!volume->coder->Decode(dataCount, codeCount, blocks, blockSize), "Error: failed to decode row '%lx'.\n", row);
+      for (int j = 0; j < missingBlocks.size(); ++j)
       {
-        if (volume->__VerifyCell(row, i+dataCount))
+        size_t oi = missingBlocks[j];
+        printf("Recovered [%lx,%lx]\n", row, oi);
+        cells.push_back({oi, blocks[oi].buffer, blockSize, 0, false});
+      }
+    }
+
+    size_t codeSize = (codeCount + localCount) * blockSize;
+    BufferPool::Buffer codeBuffer = volume->rowPool.Acquire(codeSize);
+
+    return_false_if(!volume->coder->Encode(dataCount, codeCount, blocks, codeBuffer.get(), blockSize));
+    EncodeLocal(volume, volume->coder, blocks, codeBuffer.get() + (codeCount * blockSize));
+
+    for (int i = 0; i < codeCount + localCount; ++i)
+    {
+      uint8_t * codeCell = codeBuffer.get() + (i * blockSize);
+      cells.push_back({i+dataCount, codeCell, blockSize, 0, false});
+    }
+
+    return_false_if_msg(!volume->__WriteCached(row, cells), "Error: failed to write row '%lx'.\n", row);
+
+    volume->MarkRebuilt(row);
+
+    return true;
+  }
+
+  // Repairs the row from the local groups alone: each group can restore one
+  // lost cell, data or local parity, by reading only the rest of the group.
+  // Returns false without touching anything if some loss needs the global
+  // parity, so the caller falls back to a full decode.
+  bool Volume::Row::DecodeLocal(const std::vector<bool> & valid)
+  {
+    size_t blockSize = volume->BlockSize();
+    uint64_t codeCount = volume->CodeCount();
+    uint64_t dataCount = volume->DataCount();
+    uint64_t localCount = volume->LocalCount();
+
+    for (uint64_t i = 0; i < codeCount; ++i)
+    {
+      if (!valid[i+dataCount])
+      {
+        return false;
+      }
+    }
+
+    std::vector<uint64_t> lost(localCount, UINT64_MAX);
+
+    for (uint64_t g = 0; g < localCount; ++g)
+    {
+      uint64_t local = volume->LocalColumn(g);
+      uint64_t end = volume->LocalGroupBegin(g + 1);
+
+      for (uint64_t i = volume->LocalGroupBegin(g); i <= end; ++i)
+      {
+        uint64_t column = (i == end) ? local : i;
+        if (!valid[column])
         {
-          size_t oi = missingBlocks[mi++];
-          return_false_if(!volume->__ReadCached(row, i+dataCount, blocks[oi].Block, blockSize, 0));
-          blocks[oi].Index = dataCount + i;
-          if (mi == missingBlocks.size())
+          if (lost[g] != UINT64_MAX)
           {
-            return_false_if_msg(cm256_decode(params, blocks), "Error: failed to decode row '%lx'.\n", row);
-            for (int j = 0; j < missingBlocks.size(); ++j)
-            {
-              oi = missingBlocks[j];
-              printf("Recovered [%lx,%lx]\n", row, oi);
-              volume->__WriteCached(row, oi, blocks[oi].Block, blockSize, 0);
-            }
-            break;
+            return false;
           }
+          lost[g] = column;
         }
       }
     }
 
-    size_t codeSize = codeCount * blockSize;
-    std::unique_ptr<uint8_t> codeBuffer(new uint8_t[codeSize]);
+    std::vector<CellIo> reads;
+    std::vector<CellIo> writes;
+    std::vector<BufferPool::Buffer> buffers;
+
+    for (uint64_t g = 0; g < localCount; ++g)
+    {
+      if (lost[g] == UINT64_MAX)
+      {
+        continue;
+      }
 
-    return_false_if(cm256_encode(params, blocks, codeBuffer.get()));
+      uint64_t local = volume->LocalColumn(g);
+      uint64_t end = volume->LocalGroupBegin(g + 1);
 
-    for (int i = 0; i < codeCount; ++i)
+      for (uint64_t i = volume->LocalGroupBegin(g); i <= end; ++i)
+      {
+        uint64_t column = (i == end) ? local : i;
+        buffers.emplace_back(volume->blockPool.Acquire());
+        if (column == lost[g])
+        {
+          writes.push_back({column, buffers.back().get(), blockSize, 0, false});
+        }
+        else
+        {
+          reads.push_back({column, buffers.back().get(), blockSize, 0, false});
+        }
+      }
+    }
+
+    return_false_if_msg(!volume->__ReadCached(row, reads), "Error: failed to read row '%lx'.\n", row);
+
+    for (auto & cell : writes)
     {
-      uint8_t * codeCell = codeBuffer.get() + (i * blockSize);
-      volume->__WriteCached(row, i+dataCount, codeCell, blockSize, 0);
+      uint64_t g = (cell.column < dataCount) ? volume->LocalGroupOf(cell.column) : cell.column - volume->LocalColumn(0);
+      uint8_t * out = static_cast<uint8_t *>(cell.buffer);
+      memset(out, 0, blockSize);
+
+      for (const auto & read : reads)
+      {
+        uint64_t rg = (read.column < dataCount) ? volume->LocalGroupOf(read.column) : read.column - volume->LocalColumn(0);
+        if (rg == g)
+        {
+          volume->coder->Add(out, static_cast<const uint8_t *>(read.buffer), blockSize);
+        }
+      }
+
+      printf("Recovered [%lx,%lx] from its local group\n", row, cell.column);
     }
 
+    return_false_if_msg(!volume->__WriteCached(row, writes), "Error: failed to write row '%lx'.\n", row);
+
     return true;
   }
 
   bool Volume::Row::Encode()
+  {
+    std::vector<CellIo> cells;
+    return Encode(cells);
+  }
+
+  // 'cells' holds the new content of full data cells that are still only in
+  // memory. The remaining data cells are read, and the given cells are written
+  // together with the parity cells in one batch.
+  bool Volume::Row::Encode(std::vector<CellIo> & cells)
   {
     size_t blockSize = volume->BlockSize();
     uint64_t codeCount = volume->CodeCount();
     uint64_t dataCount = volume->DataCount();
+    uint64_t localCount = volume->LocalCount();
 
-    cm256_encoder_params params;
-    params.BlockBytes = blockSize;
-    params.OriginalCount = dataCount;
-    params.RecoveryCount = codeCount;
+    ErasureBlock blocks[256] = {};
 
-    size_t dataSize = dataCount * blockSize;
-    std::unique_ptr<uint8_t> dataBuffer(new uint8_t[dataSize]);
-    memset(dataBuffer.get(), 0, dataSize);
+    for (const auto & cell : cells)
+    {
+      return_false_if(cell.column >= dataCount || cell.size != blockSize || cell.offset != 0);
+      blocks[cell.column].buffer = cell.buffer;
+    }
 
-    cm256_block blocks[256];
+    size_t dataSize = dataCount * blockSize;
+    BufferPool::Buffer dataBuffer = volume->rowPool.Acquire(dataSize);
+    std::vector<CellIo> reads;
 
     for (int i = 0; i < dataCount; i++)
     {
-      uint8_t * dataCell = dataBuffer.get() + (i * blockSize);
-      volume->__ReadCached(row, i, dataCell, blockSize, 0);
-      blocks[i].Block = dataCell;
+      if (blocks[i].buffer == nullptr)
+      {
+        uint8_t * dataCell = dataBuffer.get() + (i * blockSize);
+        memset(dataCell, 0, blockSize);
+        reads.push_back({(uint64_t)i, dataCell, blockSize, 0, false});
+        blocks[i].buffer = dataCell;
+      }
     }
 
-    size_t codeSize = codeCount * blockSize;
-    std::unique_ptr<uint8_t> codeBuffer(new uint8_t[codeSize]);
+    if (reads.size() > 0)
+    {
+      return_false_if_msg(!volume->__ReadCached(row, reads), "Error: failed to read the data cells of row '%lx'.\n", row);
+    }
 
-    return_false_if_msg(cm256_encode(params, blocks, codeBuffer.get()), "Error: erasure coding failed\n")
+    size_t codeSize = (codeCount + localCount) * blockSize;
+    BufferPool::Buffer codeBuffer = volume->rowPool.Acquire(codeSize);
 
-    for (int i = 0; i < params.RecoveryCount; ++i)
+    return_false_if_msg(!volume->coder->Encode(dataCount, codeCount, blocks, codeBuffer.get(), blockSize), "Error: erasure coding failed\n")
+    EncodeLocal(volume, volume->coder, blocks, codeBuffer.get() + (codeCount * blockSize));
+
+    std::vector<CellIo> writes = cells;
+
+    for (int i = 0; i < codeCount + localCount; ++i)
     {
       uint8_t * codeCell = codeBuffer.get() + (i * blockSize);
-      volume->__WriteCached(row, i+dataCount, codeCell, blockSize, 0);
+      writes.push_back({i+dataCount, codeCell, blockSize, 0, false});
+    }
+
+    return_false_if_msg(!volume->__WriteCached(row, writes), "Error: failed to write row '%lx'.\n", row);
+
+    return true;
+  }
+
+  bool Volume::Row::Update(const std::vector<CellIo> & deltas)
+  {
+    uint64_t codeCount = volume->CodeCount();
+    uint64_t dataCount = volume->DataCount();
+
+    if (deltas.empty())
+    {
+      return true;
     }
 
+    // Only the byte range touched by the deltas changes in the parity cells.
+    size_t begin = volume->BlockSize();
+    size_t end = 0;
+    for (const auto & delta : deltas)
+    {
+      begin = std::min(begin, delta.offset);
+      end = std::max(end, delta.offset + delta.size);
+    }
+
+    if (begin >= end)
+    {
+      return true;
+    }
+
+    // Local parity only changes for the groups that were written to.
+    std::vector<bool> groups(volume->LocalCount(), false);
+    uint64_t parityCount = codeCount;
+    for (const auto & delta : deltas)
+    {
+      if (groups.size() > 0 && delta.size > 0 && !groups[volume->LocalGroupOf(delta.column)])
+      {
+        groups[volume->LocalGroupOf(delta.column)] = true;
+        ++parityCount;
+      }
+    }
+
+    size_t rangeSize = end - begin;
+    BufferPool::Buffer codeBuffer = volume->rowPool.Acquire(parityCount * rangeSize);
+    std::vector<CellIo> cells;
+
+    for (uint64_t i = 0; i < codeCount; ++i)
+    {
+      cells.push_back({i+dataCount, codeBuffer.get() + (i * rangeSize), rangeSize, begin, false});
+    }
+
+    for (uint64_t g = 0; g < groups.size(); ++g)
+    {
+      if (groups[g])
+      {
+        cells.push_back({volume->LocalColumn(g), codeBuffer.get() + (cells.size() * rangeSize), rangeSize, begin, false});
+      }
+    }
+
+    return_false_if_msg(!volume->__ReadCached(row, cells), "Error: failed to read parity of row '%lx'.\n", row);
+
+    // parity' = parity ^ coef * (data ^ data')
+    for (uint64_t i = 0; i < codeCount; ++i)
+    {
+      uint8_t * codeCell = codeBuffer.get() + (i * rangeSize);
+      for (const auto & delta : deltas)
+      {
+        if (delta.size == 0)
+        {
+          continue;
+        }
+
+        volume->coder->MulAdd(codeCell + (delta.offset - begin),
+                              static_cast<const uint8_t *>(delta.buffer),
+                              ErasureCoder::Coefficient(dataCount, i, delta.column),
+                              delta.size);
+      }
+    }
+
+    for (uint64_t i = codeCount; i < cells.size(); ++i)
+    {
+      uint8_t * localCell = static_cast<uint8_t *>(cells[i].buffer);
+      uint64_t g = cells[i].column - volume->LocalColumn(0);
+      for (const auto & delta : deltas)
+      {
+        if (delta.size > 0 && volume->LocalGroupOf(delta.column) == g)
+        {
+          volume->coder->Add(localCell + (delta.offset - begin), static_cast<const uint8_t *>(delta.buffer), delta.size);
+        }
+      }
+    }
+
+    return_false_if_msg(!volume->__WriteCached(row, cells), "Error: failed to write parity of row '%lx'.\n", row);
+
     return true;
   }
 }
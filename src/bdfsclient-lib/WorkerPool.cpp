@@ -0,0 +1,131 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+namespace dfs
+{
+  WorkerPool::Batch::Batch(WorkerPool * pool)
+    : pool(pool)
+  {
+  }
+
+
+  WorkerPool::Batch::~Batch()
+  {
+    Wait();
+  }
+
+
+  size_t WorkerPool::Batch::Submit(std::function<bool()> task)
+  {
+    results.emplace_back(pool->Submit(std::move(task)));
+    return results.size() - 1;
+  }
+
+
+  bool WorkerPool::Batch::Wait(size_t index)
+  {
+    results[index]->Wait();
+    return results[index]->GetResult();
+  }
+
+
+  bool WorkerPool::Batch::Wait()
+  {
+    bool success = true;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      success = Wait(i) && success;
+    }
+    return success;
+  }
+
+
+  WorkerPool::WorkerPool(size_t threads)
+    : active(true)
+  {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+    {
+      this->threads.emplace_back(std::bind(&WorkerPool::ThreadProc, this));
+    }
+  }
+
+
+  WorkerPool::~WorkerPool()
+  {
+    if (this->active)
+    {
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->active = false;
+        this->cond.notify_all();
+      }
+
+      for (auto & thread : this->threads)
+      {
+        if (thread.joinable())
+        {
+          thread.join();
+        }
+      }
+    }
+  }
+
+
+  bdfs::AsyncResultPtr<bool> WorkerPool::Submit(std::function<bool()> task)
+  {
+    auto result = std::make_shared<bdfs::AsyncResult<bool>>();
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->tasks.push_back({std::move(task), result});
+    this->cond.notify_one();
+
+    return result;
+  }
+
+
+  void WorkerPool::ThreadProc()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true)
+    {
+      this->cond.wait(lock, [this]() { return !this->active || !this->tasks.empty(); });
+
+      // Queued tasks still run when stopping, their callers are waiting.
+      if (this->tasks.empty())
+      {
+        break;
+      }
+
+      Task task = std::move(this->tasks.front());
+      this->tasks.pop_front();
+
+      lock.unlock();
+      task.result->Complete(task.run());
+      lock.lock();
+    }
+  }
+}
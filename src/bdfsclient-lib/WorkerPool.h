@@ -0,0 +1,98 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+#include "AsyncResult.h"
+
+namespace dfs
+{
+  // A few worker threads that run short tasks, such as encrypting cells or
+  // serving the rows of a large request, while the caller goes on.
+  class WorkerPool
+  {
+  public:
+
+    // Tasks submitted through a batch are waited for when it goes out of
+    // scope, so they never outlive the buffers they work on. Declare it after
+    // those buffers.
+    class Batch
+    {
+    public:
+
+      explicit Batch(WorkerPool * pool);
+
+      ~Batch();
+
+      // Returns the index to wait on.
+      size_t Submit(std::function<bool()> task);
+
+      bool Wait(size_t index);
+
+      bool Wait();
+
+    private:
+
+      WorkerPool * pool;
+
+      std::vector<bdfs::AsyncResultPtr<bool>> results;
+    };
+
+    explicit WorkerPool(size_t threads);
+
+    ~WorkerPool();
+
+    bdfs::AsyncResultPtr<bool> Submit(std::function<bool()> task);
+
+  private:
+
+    void ThreadProc();
+
+  private:
+
+    struct Task
+    {
+      std::function<bool()> run;
+      bdfs::AsyncResultPtr<bool> result;
+    };
+
+    std::deque<Task> tasks;
+
+    std::mutex mutex;
+
+    std::condition_variable cond;
+
+    std::vector<std::thread> threads;
+
+    std::atomic<bool> active;
+  };
+}
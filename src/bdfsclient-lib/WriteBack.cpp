@@ -0,0 +1,361 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "WriteBack.h"
+#include "Volume.h"
+#include "Util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <algorithm>
+
+namespace dfs
+{
+  // Times a cell is tried before the upload of its row is given up on.
+  static const uint32_t UPLOAD_ATTEMPTS = 5;
+
+  // Delay in ms before the first retry, doubled for each one after it.
+  static const uint32_t RETRY_DELAY = 100;
+
+  static const size_t MAX_THREADS = 32;
+
+
+  WriteBack::WriteBack(Volume * volume, size_t hostLimit, Done done)
+    : volume(volume)
+    , hostLimit(std::max<size_t>(hostLimit, 1))
+    , done(std::move(done))
+    , pending(0)
+    , running(true)
+  {
+    // A thread for every upload that may be going out at a time
+    std::set<std::string> hosts;
+    for (uint64_t column = 0; column < volume->Columns(); ++column)
+    {
+      hosts.insert(volume->GetHost(column));
+    }
+
+    size_t count = std::min(this->hostLimit * std::max<size_t>(hosts.size(), 1), MAX_THREADS);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      this->threads.emplace_back(std::bind(&WriteBack::ThreadProc, this));
+    }
+  }
+
+
+  WriteBack::~WriteBack()
+  {
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->running = false;
+      this->cond.notify_all();
+    }
+
+    for (auto & thread : this->threads)
+    {
+      if (thread.joinable())
+      {
+        thread.join();
+      }
+    }
+  }
+
+
+  bool WriteBack::Enqueue(uint64_t row, const std::vector<CellIo> & cells, uint64_t version)
+  {
+    if (cells.empty())
+    {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    auto itr = this->active.find(row);
+    if (itr != this->active.end() && !itr->second->started && !itr->second->cancelled)
+    {
+      return this->Merge(itr->second, cells, version, true);
+    }
+
+    if (itr == this->active.end())
+    {
+      std::shared_ptr<Job> job(new Job());
+      job->row = row;
+
+      bool merged = this->Merge(job, cells, version, true);
+      if (job->left > 0)
+      {
+        this->active[row] = job;
+        this->volume->BeginWriting(row);
+      }
+
+      return merged;
+    }
+
+    auto & job = this->queued[row];
+    if (!job)
+    {
+      job.reset(new Job());
+      job->row = row;
+    }
+
+    return this->Merge(job, cells, version, false);
+  }
+
+
+  void WriteBack::Cancel(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    auto itr = this->queued.find(row);
+    if (itr != this->queued.end())
+    {
+      this->pending -= itr->second->bytes;
+      this->queued.erase(itr);
+    }
+
+    auto found = this->active.find(row);
+    if (found != this->active.end())
+    {
+      std::shared_ptr<Job> job = found->second;
+      job->cancelled = true;
+
+      for (auto & entry : this->uploads)
+      {
+        auto & queue = entry.second;
+        for (auto upload = queue.begin(); upload != queue.end(); )
+        {
+          if (upload->job == job)
+          {
+            upload = queue.erase(upload);
+            this->Settle(job, false);
+          }
+          else
+          {
+            ++upload;
+          }
+        }
+      }
+    }
+
+    this->settled.wait(lock, [this, row]() { return this->active.count(row) == 0; });
+  }
+
+
+  void WriteBack::Wait(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->settled.wait(lock, [this, row]() {
+      return this->active.count(row) == 0 && this->queued.count(row) == 0;
+    });
+  }
+
+
+  void WriteBack::ThreadProc()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true)
+    {
+      Upload upload;
+      std::string host;
+      std::chrono::steady_clock::time_point wake;
+
+      if (!this->Next(upload, host, wake))
+      {
+        if (!this->running && this->active.empty())
+        {
+          break;
+        }
+
+        if (wake == std::chrono::steady_clock::time_point::max())
+        {
+          this->cond.wait(lock);
+        }
+        else
+        {
+          this->cond.wait_until(lock, wake);
+        }
+
+        continue;
+      }
+
+      auto & job = upload.job;
+      auto & cell = job->cells[upload.index];
+
+      // A row claimed before its upload began is left alone until released,
+      // rather than waited for here, where it would hold up Cancel. No claim
+      // can be taken once the row is marked as being written.
+      if (this->volume->IsClaimed(job->row))
+      {
+        upload.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(RETRY_DELAY);
+        this->uploads[host].push_back(std::move(upload));
+        continue;
+      }
+
+      // From here on the cells handed over for the row wait for this upload
+      job->started = true;
+      this->busy[host] += 1;
+
+      lock.unlock();
+
+      bool success = this->volume->__WriteDirect(job->row, cell.column, cell.data.Buf(), cell.data.Size(), 0);
+
+      lock.lock();
+
+      this->busy[host] -= 1;
+      this->cond.notify_all();
+
+      if (!success && !job->cancelled && ++upload.attempts < UPLOAD_ATTEMPTS)
+      {
+        upload.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(RETRY_DELAY << (upload.attempts - 1));
+        this->uploads[host].push_back(std::move(upload));
+        continue;
+      }
+
+      if (!success)
+      {
+        printf("Error: failed to write back the cache block: row=%llu column=%llu\n",
+          (long long unsigned)job->row, (long long unsigned)cell.column);
+      }
+
+      this->Settle(job, success);
+    }
+  }
+
+
+  bool WriteBack::Merge(const std::shared_ptr<Job> & job, const std::vector<CellIo> & cells, uint64_t version, bool start)
+  {
+    for (const auto & cell : cells)
+    {
+      size_t index = 0;
+      while (index < job->cells.size() && job->cells[index].column != cell.column)
+      {
+        ++index;
+      }
+
+      if (index == job->cells.size())
+      {
+        Cell added;
+        added.column = cell.column;
+        return_false_if(!added.data.Resize(cell.size));
+
+        job->cells.push_back(std::move(added));
+        job->bytes += cell.size;
+        job->left += 1;
+        this->pending += cell.size;
+
+        if (start)
+        {
+          this->Start(job, index);
+        }
+      }
+
+      memcpy(job->cells[index].data.Buf(), cell.buffer, cell.size);
+    }
+
+    job->version = version;
+
+    return true;
+  }
+
+
+  void WriteBack::Start(const std::shared_ptr<Job> & job, size_t index)
+  {
+    std::string host = this->volume->GetHost(job->cells[index].column);
+
+    this->uploads[host].push_back({job, index, 0, std::chrono::steady_clock::now()});
+    this->cond.notify_one();
+  }
+
+
+  bool WriteBack::Next(Upload & upload, std::string & host, std::chrono::steady_clock::time_point & wake)
+  {
+    auto now = std::chrono::steady_clock::now();
+    wake = std::chrono::steady_clock::time_point::max();
+
+    for (auto & entry : this->uploads)
+    {
+      if (this->busy[entry.first] >= this->hostLimit)
+      {
+        continue;
+      }
+
+      auto & queue = entry.second;
+      for (auto itr = queue.begin(); itr != queue.end(); ++itr)
+      {
+        if (itr->due <= now)
+        {
+          upload = std::move(*itr);
+          host = entry.first;
+          queue.erase(itr);
+          return true;
+        }
+
+        wake = std::min(wake, itr->due);
+      }
+    }
+
+    return false;
+  }
+
+
+  void WriteBack::Settle(const std::shared_ptr<Job> & job, bool success)
+  {
+    job->success = job->success && success;
+
+    if (--job->left > 0)
+    {
+      return;
+    }
+
+    this->pending -= job->bytes;
+    this->active.erase(job->row);
+
+    // Reported before the waiters wake up, so that they see the outcome
+    if (!job->cancelled && this->done)
+    {
+      this->done(job->row, job->version, job->success);
+    }
+
+    // The row stays marked as being written while a queued job takes over
+    auto itr = this->queued.find(job->row);
+    if (itr != this->queued.end())
+    {
+      std::shared_ptr<Job> next = itr->second;
+      this->queued.erase(itr);
+      this->active[next->row] = next;
+
+      for (size_t i = 0; i < next->cells.size(); ++i)
+      {
+        this->Start(next, i);
+      }
+    }
+    else
+    {
+      this->volume->EndWriting(job->row);
+    }
+
+    this->settled.notify_all();
+  }
+}
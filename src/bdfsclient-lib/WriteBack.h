@@ -0,0 +1,156 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include "Buffer.h"
+
+namespace dfs
+{
+  class Volume;
+
+  struct CellIo;
+
+  // Uploads the dirty rows of the cache in the background. The cells handed
+  // over are copied, so the cache can go on changing them meanwhile.
+  //
+  // Every cell goes out on its own, at most 'hostLimit' at a time to the same
+  // host, so a slow host only holds back its own cells. BdSession sends the
+  // requests to a host one after the other, so a limit above 1 just queues
+  // more cells there ahead of foreground reads. Cells that fail are tried
+  // again after a delay that doubles each time.
+  //
+  // Rows handed over again before any of their cells went out take the new
+  // cells in place of the old ones, so a cell written many times in a row is
+  // uploaded once. Otherwise the new cells wait until the upload under way
+  // for the row is over.
+  class WriteBack
+  {
+  public:
+
+    // Called once every cell handed over with 'version' was uploaded or
+    // given up on, unless the row was cancelled.
+    typedef std::function<void(uint64_t row, uint64_t version, bool success)> Done;
+
+    WriteBack(Volume * volume, size_t hostLimit, Done done);
+
+    // Uploads the rows still queued before returning.
+    ~WriteBack();
+
+    // The cells hold whole blocks.
+    bool Enqueue(uint64_t row, const std::vector<CellIo> & cells, uint64_t version);
+
+    // Drops the cells of the row that haven't gone out yet and waits for
+    // those that have.
+    void Cancel(uint64_t row);
+
+    // Returns once nothing is queued or being uploaded for the row.
+    void Wait(uint64_t row);
+
+    // Bytes queued or being uploaded.
+    size_t Pending() const { return pending; }
+
+  private:
+
+    struct Cell
+    {
+      uint64_t column;
+      bdfs::Buffer data;
+    };
+
+    struct Job
+    {
+      uint64_t row;
+      uint64_t version;
+      std::vector<Cell> cells;
+      size_t bytes = 0;
+      size_t left = 0;
+      bool started = false;
+      bool success = true;
+      bool cancelled = false;
+    };
+
+    struct Upload
+    {
+      std::shared_ptr<Job> job;
+      size_t index;
+      uint32_t attempts;
+      std::chrono::steady_clock::time_point due;
+    };
+
+    void ThreadProc();
+
+    // The rest are called with 'mutex' held.
+    bool Merge(const std::shared_ptr<Job> & job, const std::vector<CellIo> & cells, uint64_t version, bool start);
+
+    void Start(const std::shared_ptr<Job> & job, size_t index);
+
+    bool Next(Upload & upload, std::string & host, std::chrono::steady_clock::time_point & wake);
+
+    void Settle(const std::shared_ptr<Job> & job, bool success);
+
+  private:
+
+    Volume * volume;
+
+    size_t hostLimit;
+
+    Done done;
+
+    // Rows with an upload under way, and the cells handed over for them
+    // since, which wait for it to end.
+    std::unordered_map<uint64_t, std::shared_ptr<Job>> active;
+
+    std::unordered_map<uint64_t, std::shared_ptr<Job>> queued;
+
+    // Cells waiting to go out, and the number going out, by host
+    std::map<std::string, std::deque<Upload>> uploads;
+
+    std::map<std::string, size_t> busy;
+
+    std::mutex mutex;
+
+    std::condition_variable cond;
+
+    std::condition_variable settled;
+
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> pending;
+
+    std::atomic<bool> running;
+  };
+}
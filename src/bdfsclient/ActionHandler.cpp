@@ -33,6 +33,11 @@
 #include "BdTypes.h"
 #include "BdSession.h"
 #include "Cache.h"
+#include "StripeBuffer.h"
+#include "Scrubber.h"
+#include "ReadAhead.h"
+#include "LazyParity.h"
+#include "WorkerPool.h"
 #include "Util.h"
 
 #include "cm256.h"
@@ -73,14 +78,12 @@ namespace dfs
 
   static int xmp_flush(void * context)
   {
-    (void)(context);
-    return 0;
+    return ((Volume*)context)->Flush() ? 0 : -1;
   }
 
   static int xmp_trim(size_t from, size_t len, void * context)
   {
-    (void)(context);
-    return 0;
+    return ((Volume*)context)->Trim(from, len) ? 0 : -1;
   }
 
   void ActionHandler::Unmount(const std::string &nbdPath, bool matchAll=false)
@@ -147,9 +150,30 @@ namespace dfs
       return 0;
     }
 
-    // Cache size set to 100MB / (blockSize * (dataCount + codeCount)), flushing every 10 seconds
+    // Cache size set to 100MB / (blockSize * (dataCount + codeCount)), flushing every 10 seconds,
+    // with the most recently used 64MB of it also kept in memory, served by 4 workers. Dirty rows
+    // go out one cell per host at a time, and writers wait while more than 64MB is dirty
     std::string cacheDir = "/var/drive/" + name + "/" + "cache";
-    volume->EnableCache(std::make_unique<dfs::Cache>(cacheDir, volume.get(), 200, 10));
+    volume->EnableCache(std::make_unique<dfs::Cache>(cacheDir, volume.get(), 200, 10, 64*1024*1024, "tinylfu", 4,
+                                                     1, 64*1024*1024));
+
+    // Incomplete stripes of sequential writes are written out after 1 second
+    volume->EnableStripe(std::make_unique<dfs::StripeBuffer>(volume.get(), 1000));
+
+    // Replaced partitions are rebuilt by 4 workers, 16 rows per batch, at most 256 rows a second
+    volume->EnableRebuild("/var/drive/" + name + "/rebuild", 4, 16, 256);
+
+    // Rows are scrubbed at up to 4MB/s and 32 reads a second while the volume is idle, one pass a day
+    volume->EnableScrub(std::make_unique<dfs::Scrubber>(volume.get(), 4*1024*1024, 32, 24*60*60));
+
+    // Sequential reads fetch up to 32 rows ahead into the cache, 4 rows at a time
+    volume->EnableReadAhead(std::make_unique<dfs::ReadAhead>(volume.get(), 32, 4));
+
+    // Requests spanning several cells are encrypted and decrypted by 4 threads
+    volume->EnableCryptoPool(std::make_unique<dfs::WorkerPool>(4));
+
+    // Requests spanning several rows have their rows served by 8 threads
+    volume->EnableWorkers(std::make_unique<dfs::WorkerPool>(8));
     
     printf("Processing: %s\n", nbdPath.c_str());
 
@@ -177,6 +201,7 @@ namespace dfs
     }
 
     VolumeMeta *meta = new VolumeMeta;
+    meta->volume = pVolume;
     meta->volumeName = name;
     meta->nbdPath = nbdPath;
     meta->mountPath = path;
@@ -205,6 +230,95 @@ namespace dfs
     return 1;
   }
   
+  bool ActionHandler::GetVolumeStatus(const std::string &name, std::vector<std::string> &status)
+  {
+    auto it = volumeInfo.find(name);
+    if(it == volumeInfo.end())
+    {
+      return false;
+    }
+
+    Volume *volume = it->second->volume;
+
+    Scrubber *scrubber = volume->GetScrubber();
+    if(scrubber)
+    {
+      auto progress = scrubber->GetProgress();
+      status.emplace_back("scrub.passes");
+      status.emplace_back(std::to_string(progress.passes));
+      status.emplace_back("scrub.row");
+      status.emplace_back(std::to_string(progress.row) + "/" + std::to_string(progress.rows));
+      status.emplace_back("scrub.scrubbed");
+      status.emplace_back(std::to_string(progress.scrubbed));
+      status.emplace_back("scrub.skipped");
+      status.emplace_back(std::to_string(progress.skipped));
+      status.emplace_back("scrub.mismatches");
+      status.emplace_back(std::to_string(progress.mismatches));
+      status.emplace_back("scrub.repaired");
+      status.emplace_back(std::to_string(progress.repaired));
+      status.emplace_back("scrub.unrepairable");
+      status.emplace_back(std::to_string(progress.unrepairable));
+    }
+
+    ReadAhead *readAhead = volume->GetReadAhead();
+    if(readAhead)
+    {
+      auto progress = readAhead->GetProgress();
+      status.emplace_back("readahead.window");
+      status.emplace_back(std::to_string(progress.window));
+      status.emplace_back("readahead.prefetched");
+      status.emplace_back(std::to_string(progress.prefetched));
+      status.emplace_back("readahead.hits");
+      status.emplace_back(std::to_string(progress.hits));
+    }
+
+    Cache *cache = volume->GetCache();
+    if(cache)
+    {
+      status.emplace_back("cache.dirty.bytes");
+      status.emplace_back(std::to_string(cache->DirtyBytes()));
+    }
+
+    const MemoryCache *memory = cache ? cache->GetMemory() : nullptr;
+    if(memory)
+    {
+      status.emplace_back("cache.memory.bytes");
+      status.emplace_back(std::to_string(memory->Bytes()));
+      status.emplace_back("cache.memory.hits");
+      status.emplace_back(std::to_string(memory->Hits()));
+      status.emplace_back("cache.memory.misses");
+      status.emplace_back(std::to_string(memory->Misses()));
+    }
+
+    LazyParity *lazyParity = volume->GetLazyParity();
+    if(lazyParity)
+    {
+      status.emplace_back("parity.pending");
+      status.emplace_back(std::to_string(lazyParity->Pending()));
+    }
+
+    for(uint64_t i = 0; i < volume->Columns(); i++)
+    {
+      const PartitionHealth *health = volume->GetHealth(i);
+      if(health)
+      {
+        auto score = health->GetScore();
+        char text[128];
+        snprintf(text, sizeof(text), "%.1f ms, %.1f%% errors, %u in flight, %lu requests, %lu errors",
+          score.latency, score.errorRate * 100, score.inFlight, score.requests, score.errors);
+        status.emplace_back("partition." + std::to_string(i));
+        status.emplace_back(text);
+      }
+    }
+
+    status.emplace_back("pool.block");
+    status.emplace_back(std::to_string(volume->BlockPool().Hits()) + " hits, " + std::to_string(volume->BlockPool().Misses()) + " misses");
+    status.emplace_back("pool.row");
+    status.emplace_back(std::to_string(volume->RowPool().Hits()) + " hits, " + std::to_string(volume->RowPool().Misses()) + " misses");
+
+    return true;
+  }
+  
   std::string ActionHandler::GetNextNBD()
   {
     for(auto it : ActionHandler::nbdInfo)
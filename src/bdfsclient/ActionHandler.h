@@ -21,11 +21,15 @@
 */
 
 #include <map>
+#include <vector>
 
 namespace dfs
 {
+  class Volume;
+
   struct VolumeMeta 
   {
+    Volume *volume;
     std::string volumeName;
     std::string nbdPath;
     std::string mountPath;
@@ -45,6 +49,9 @@ namespace dfs
     static void Cleanup();
     static int BindVolume(const std::string &name, const std::string &path);
     static int UnbindVolume(const std::string &name);
+
+    // Fills 'status' with name/value pairs describing a bound volume.
+    static bool GetVolumeStatus(const std::string &name, std::vector<std::string> &status);
     
     static inline void AddNbdPath(std::string path)
     {
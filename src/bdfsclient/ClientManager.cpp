@@ -133,6 +133,15 @@ namespace dfs
         break;
       }
 
+      case bdcp::QUERY_VOLUMESTATUS:
+      {
+        if(inArgs.size() == 1)
+        {
+          status = ActionHandler::GetVolumeStatus(inArgs[0], args) ? 1 : 0;
+        }
+        break;
+      }
+
       default:
         printf("Unhandled instruction of type : %d\n",((bdcp::BdHdr *)buff.get())->type);
     }
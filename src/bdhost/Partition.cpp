@@ -24,6 +24,8 @@
 #include "Options.h"
 
 #include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 namespace bdhost
@@ -80,9 +82,10 @@ namespace bdhost
     return true;
   }
 
+  // Blocks start out sparse: the zeros take no space until written over,
+  // and clients that write only the head of a block leave the rest a hole.
   bool Partition::InitBlock(uint64_t index)
   {
-    uint8_t buffer[4096] = {0};
     char fileName[1024];
     snprintf(fileName, sizeof(fileName), "%s/block-%lx", partitionPath.c_str(), index);
     FILE * file = fopen(fileName, "r+");
@@ -91,14 +94,9 @@ namespace bdhost
       file = fopen(fileName, "w+");
       return_false_if_msg(file == NULL, "Error: failed to open file '%s' for writing.\n", fileName);
     }
-    size_t remaining = blockSize;
-    while (remaining > 0)
-    {
-      size_t toWrite = remaining>sizeof(buffer)?sizeof(buffer):remaining;
-      fwrite(buffer, toWrite, 1, file);
-      remaining -= toWrite;
-    }
+    int rtn = ftruncate(fileno(file), 0) == 0 ? ftruncate(fileno(file), blockSize) : -1;
     fclose(file);
+    return_false_if_msg(rtn != 0, "Error: failed to size file '%s'.\n", fileName);
 
     partitionMap[index] = true;
 
@@ -157,4 +155,35 @@ namespace bdhost
 
     return true;
   }
+
+  bool Partition::TrimBlock(uint64_t index, size_t size, size_t offset)
+  {
+    return_false_if_msg(index >= blockCount, "Error: 'index' is out of range: %ld >= %ld\n", index, blockCount);
+    return_false_if_msg((offset + size) > blockSize, "Error: 'offset+size' is out of range: %ld > %ld\n", (offset + size), blockSize);
+
+    if (!partitionMap[index])
+    {
+      return true;
+    }
+
+    char fileName[1024];
+    snprintf(fileName, sizeof(fileName), "%s/block-%lx", partitionPath.c_str(), index);
+
+    if (offset == 0 && size == blockSize)
+    {
+      // Unmapped blocks read as zeros, so the file can go altogether
+      partitionMap[index] = false;
+      FlushMap();
+      unlink(fileName);
+      return true;
+    }
+
+    int fd = open(fileName, O_WRONLY);
+    return_false_if_msg(fd == -1, "Error: failed to open file '%s' for writing.\n", fileName);
+    int rtn = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size);
+    close(fd);
+    return_false_if_msg(rtn == -1, "Error: failed to punch hole in '%s'.\n", fileName);
+
+    return true;
+  }
 }
@@ -55,5 +55,6 @@ namespace bdhost
     bool InitBlock(uint64_t index);
     bool ReadBlock(uint64_t index, void * buffer, size_t size, size_t offset);
     bool WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset);
+    bool TrimBlock(uint64_t index, size_t size, size_t offset);
   };
 }
@@ -246,6 +246,10 @@ namespace bdhost
     {
       this->OnWriteBlock(context, name, blockCount, blockSize);
     }
+    else if (action == "TrimBlock")
+    {
+      this->OnTrimBlock(context, name, blockCount, blockSize);
+    }
     else if (action == "Delete")
     {
       this->OnDelete(context, name);
@@ -320,6 +324,32 @@ namespace bdhost
   }
 
 
+  void PartitionHandler::OnTrimBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize)
+  {
+    uint64_t blockId = static_cast<uint64_t>(strtoull(context.parameter("block"), nullptr, 10));
+    uint32_t offset = static_cast<uint32_t>(strtoul(context.parameter("offset"), nullptr, 10));
+    uint32_t size = static_cast<uint32_t>(strtoul(context.parameter("size"), nullptr, 10));
+
+    if (blockId >= blockCount || offset >= blockSize || size > blockSize - offset)
+    {
+      context.setResponseCode(500);
+      context.writeError("Failed", "Invalid arguments", bdhttp::ErrorCode::ARGUMENT_INVALID);
+      return;
+    }
+
+    Partition partition{name.c_str(), blockCount, blockSize};
+    if (partition.TrimBlock(blockId, size, offset))
+    {
+      context.writeResponse("true");
+    }
+    else
+    {
+      context.setResponseCode(500);
+      context.writeError("Failed", "Failed to trim block", bdhttp::ErrorCode::GENERIC_ERROR);
+    }
+  }
+
+
   void PartitionHandler::OnDelete(bdhttp::HttpContext & context, const std::string & name)
   {
     // TODO: release the reference to contract
@@ -42,6 +42,8 @@ namespace bdhost
 
     void OnWriteBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize);
 
+    void OnTrimBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize);
+
     void OnDelete(bdhttp::HttpContext & context, const std::string & name);
 
     void OnCreatePartition(bdhttp::HttpContext & context);
@@ -0,0 +1,267 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Replays block device traces against the cache replacement policies and
+// prints the hit ratio of each. Traces are text files with one request per
+// line, "R <offset> <length>" or "W <offset> <length>" in bytes, such as the
+// output of blkparse -f "%d %S %N\n" with sectors scaled to bytes. Without
+// traces, a few synthetic ones are generated.
+//
+//   cachebench <cache rows> <row size> [trace ...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include "CachePolicy.h"
+
+using namespace dfs;
+
+struct Access
+{
+  uint64_t row;
+  bool write;
+};
+
+struct Trace
+{
+  std::string name;
+  std::vector<Access> accesses;
+};
+
+
+static bool LoadTrace(const char * path, uint64_t rowSize, Trace & trace)
+{
+  FILE * file = fopen(path, "r");
+  if (!file)
+  {
+    printf("Error: failed to open '%s'.\n", path);
+    return false;
+  }
+
+  trace.name = path;
+
+  char type;
+  unsigned long long offset;
+  unsigned long long length;
+
+  while (fscanf(file, " %c %llu %llu", &type, &offset, &length) == 3)
+  {
+    bool write = (type == 'W' || type == 'w');
+    uint64_t last = (offset + std::max<unsigned long long>(length, 1) - 1) / rowSize;
+
+    for (uint64_t row = offset / rowSize; row <= last; ++row)
+    {
+      trace.accesses.push_back({row, write});
+    }
+  }
+
+  fclose(file);
+
+  return true;
+}
+
+
+// Rows drawn from a Zipf distribution over 'rows' rows.
+class Zipf
+{
+public:
+
+  Zipf(uint64_t rows, double skew)
+  {
+    double sum = 0;
+    for (uint64_t i = 1; i <= rows; ++i)
+    {
+      sum += 1.0 / pow(static_cast<double>(i), skew);
+      this->cdf.push_back(sum);
+    }
+
+    for (auto & value : this->cdf)
+    {
+      value /= sum;
+    }
+  }
+
+  uint64_t Next(std::mt19937_64 & rng)
+  {
+    double value = std::uniform_real_distribution<double>(0, 1)(rng);
+    return std::lower_bound(this->cdf.begin(), this->cdf.end(), value) - this->cdf.begin();
+  }
+
+private:
+
+  std::vector<double> cdf;
+};
+
+
+static std::vector<Trace> SyntheticTraces(uint64_t capacity)
+{
+  std::vector<Trace> traces;
+  std::mt19937_64 rng(1);
+
+  uint64_t rows = capacity * 20;
+  Zipf zipf(rows, 0.9);
+
+  // Skewed reads and writes, such as a filesystem's metadata
+  Trace skewed{"zipf", {}};
+  for (int i = 0; i < 200000; ++i)
+  {
+    skewed.accesses.push_back({zipf.Next(rng), rng() % 4 == 0});
+  }
+  traces.push_back(std::move(skewed));
+
+  // The same, interrupted by backups reading twice as many rows as the
+  // cache holds
+  Trace scan{"zipf+scan", {}};
+  for (int i = 0; i < 100000; ++i)
+  {
+    scan.accesses.push_back({zipf.Next(rng), rng() % 4 == 0});
+  }
+  for (int pass = 0; pass < 10; ++pass)
+  {
+    for (uint64_t row = 0; row < capacity * 2; ++row)
+    {
+      scan.accesses.push_back({rows + row, false});
+    }
+
+    for (int i = 0; i < 10000; ++i)
+    {
+      scan.accesses.push_back({zipf.Next(rng), rng() % 4 == 0});
+    }
+  }
+  for (int i = 0; i < 100000; ++i)
+  {
+    scan.accesses.push_back({zipf.Next(rng), rng() % 4 == 0});
+  }
+  traces.push_back(std::move(scan));
+
+  // A working set a little larger than the cache read over and over
+  Trace loop{"loop", {}};
+  for (int i = 0; i < 200000; ++i)
+  {
+    loop.accesses.push_back({static_cast<uint64_t>(i) % (capacity * 3 / 2), false});
+  }
+  traces.push_back(std::move(loop));
+
+  return traces;
+}
+
+
+// Mirrors what dfs::Cache does on every access: writes are always cached,
+// rows read from the partitions only if the policy admits them.
+static double Replay(const Trace & trace, const std::string & name, uint64_t capacity)
+{
+  auto policy = CachePolicy::Create(name, capacity);
+  std::unordered_set<uint64_t> cached;
+  uint64_t hits = 0;
+
+  for (const auto & access : trace.accesses)
+  {
+    policy->Access(access.row);
+
+    if (cached.count(access.row) > 0)
+    {
+      ++hits;
+      continue;
+    }
+
+    if (!access.write && cached.size() >= capacity && !policy->Admit(access.row))
+    {
+      continue;
+    }
+
+    cached.insert(access.row);
+    policy->Insert(access.row, true);
+
+    if (cached.size() > capacity)
+    {
+      uint64_t victim = UINT64_MAX;
+      policy->Victims([&victim](uint64_t row) { victim = row; return false; });
+
+      policy->Erase(victim);
+      cached.erase(victim);
+    }
+  }
+
+  return trace.accesses.empty() ? 0 : 100.0 * hits / trace.accesses.size();
+}
+
+
+int main(int argc, char ** argv)
+{
+  if (argc < 3)
+  {
+    printf("Usage: %s <cache rows> <row size> [trace ...]\n", argv[0]);
+    return -1;
+  }
+
+  uint64_t capacity = strtoull(argv[1], nullptr, 10);
+  uint64_t rowSize = strtoull(argv[2], nullptr, 10);
+  if (capacity == 0 || rowSize == 0)
+  {
+    printf("Error: cache rows and row size must be positive.\n");
+    return -1;
+  }
+
+  std::vector<Trace> traces;
+  for (int i = 3; i < argc; ++i)
+  {
+    Trace trace;
+    if (!LoadTrace(argv[i], rowSize, trace))
+    {
+      return -1;
+    }
+
+    traces.push_back(std::move(trace));
+  }
+
+  if (traces.empty())
+  {
+    traces = SyntheticTraces(capacity);
+  }
+
+  const char * policies[] = {"lru", "slru", "tinylfu"};
+
+  printf("%-24s %10s", "trace", "accesses");
+  for (auto policy : policies)
+  {
+    printf(" %9s", policy);
+  }
+  printf("\n");
+
+  for (const auto & trace : traces)
+  {
+    printf("%-24s %10zu", trace.name.c_str(), trace.accesses.size());
+    for (auto policy : policies)
+    {
+      printf(" %8.2f%%", Replay(trace, policy, capacity));
+    }
+    printf("\n");
+  }
+
+  return 0;
+}